@@ -6,6 +6,8 @@
 #include <functional>
 #include <limits>
 #include <cmath>
+#include <stdexcept>
+#include <string>
 
 namespace pH {
 
@@ -3,15 +3,208 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
 #include <iterator>
 #include <fstream>
 #include <algorithm>
 #include <functional>
+#include <initializer_list>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <ostream>
+#include <stdexcept>
+#include <cstdint>
+#include <limits>
+#include <tuple>
+#include <type_traits>
+#include <cctype>
+#include <cfloat>
+#include <cmath>
+#include <locale>
+#include <sstream>
+
+#if defined(__x86_64__)
+#define PH_CSV_X86
+#include <immintrin.h>
+#endif
 
 namespace pH {
 
 namespace csv {
 
+// Non-owning reference to a field, similar to C++17 std::string_view
+class view {
+ public:
+  view() : data_(nullptr), size_(0) {}
+  view(const char* data, size_t size) : data_(data), size_(size) {}
+  view(const char* str) : data_(str), size_(std::strlen(str)) {}
+  view(const std::string& str) : data_(str.data()), size_(str.size()) {}
+  template <typename Allocator>
+  view(const std::basic_string<char, std::char_traits<char>, Allocator>& str) : data_(str.data()), size_(str.size()) {}
+
+  inline const char* data() const { return data_; }
+  inline size_t size() const { return size_; }
+  inline bool empty() const { return size_ == 0; }
+
+  inline const char* begin() const { return data_; }
+  inline const char* end() const { return data_ + size_; }
+  inline char operator[](size_t i) const { return data_[i]; }
+
+  inline std::string str() const { return std::string(data_, size_); }
+  explicit operator std::string() const { return str(); }
+
+ private:
+  const char* data_;
+  size_t size_;
+};
+
+inline bool operator==(const view& a, const view& b) {
+  return a.size() == b.size() && (a.size() == 0 || std::memcmp(a.data(), b.data(), a.size()) == 0);
+}
+inline bool operator!=(const view& a, const view& b) { return !(a == b); }
+
+inline std::ostream& operator<<(std::ostream& out, const view& field) {
+  return out.write(field.data(), field.size());
+}
+
+enum class conversion_error {
+  none,
+  empty,
+  invalid,
+  out_of_range
+};
+
+// Selects columns, by header name or by index, for readers to keep. Rows then only contain the
+// selected columns in the given order, and the other fields are never copied or unescaped.
+class projection {
+ public:
+  projection(std::initializer_list<std::string> names) : names_(names), indices_() {}
+  projection(std::initializer_list<size_t> indices) : names_(), indices_(indices) {}
+  projection(std::vector<std::string> names) : names_(std::move(names)), indices_() {}
+  projection(std::vector<size_t> indices) : names_(), indices_(std::move(indices)) {}
+
+  inline const std::vector<std::string>& names() const { return names_; }
+  inline const std::vector<size_t>& indices() const { return indices_; }
+
+ private:
+  std::vector<std::string> names_;
+  std::vector<size_t> indices_;
+};
+
+// Column index resolved once from a header name, to access fields without looking up the name
+class column_handle {
+ public:
+  column_handle() : index_(std::numeric_limits<size_t>::max()) {}
+  explicit column_handle(size_t index) : index_(index) {}
+
+  inline size_t index() const { return index_; }
+  explicit operator bool() const { return index_ != std::numeric_limits<size_t>::max(); }
+
+ private:
+  size_t index_;
+};
+
+// Condition on a column, checked on the raw field before a row is copied. Created with equals,
+// startsWith, lessThan, greaterThan or between. Fields missing from a row are empty.
+struct predicate {
+  enum class type { equals, starts_with, range };
+
+  std::string name;
+  size_t index;
+  bool by_name;
+  type kind;
+  std::string value;  // for equals and starts_with
+  double min;  // for range, fields that are not numbers never match
+  double max;
+  bool min_inclusive;
+  bool max_inclusive;
+};
+
+namespace detail {
+
+inline predicate makePredicate(std::string name, size_t index, bool by_name, predicate::type kind, std::string value) {
+  return predicate{std::move(name), index, by_name, kind, std::move(value), 0.0, 0.0, false, false};
+}
+
+inline predicate makePredicate(std::string name, size_t index, bool by_name, double min, double max, bool min_inclusive, bool max_inclusive) {
+  return predicate{std::move(name), index, by_name, predicate::type::range, std::string(), min, max, min_inclusive, max_inclusive};
+}
+
+}  // namespace detail
+
+inline predicate equals(std::string column, std::string value) {
+  return detail::makePredicate(std::move(column), 0, true, predicate::type::equals, std::move(value));
+}
+
+inline predicate equals(size_t column, std::string value) {
+  return detail::makePredicate(std::string(), column, false, predicate::type::equals, std::move(value));
+}
+
+inline predicate startsWith(std::string column, std::string prefix) {
+  return detail::makePredicate(std::move(column), 0, true, predicate::type::starts_with, std::move(prefix));
+}
+
+inline predicate startsWith(size_t column, std::string prefix) {
+  return detail::makePredicate(std::string(), column, false, predicate::type::starts_with, std::move(prefix));
+}
+
+inline predicate lessThan(std::string column, double value) {
+  return detail::makePredicate(std::move(column), 0, true, -HUGE_VAL, value, true, false);
+}
+
+inline predicate lessThan(size_t column, double value) {
+  return detail::makePredicate(std::string(), column, false, -HUGE_VAL, value, true, false);
+}
+
+inline predicate greaterThan(std::string column, double value) {
+  return detail::makePredicate(std::move(column), 0, true, value, HUGE_VAL, false, true);
+}
+
+inline predicate greaterThan(size_t column, double value) {
+  return detail::makePredicate(std::string(), column, false, value, HUGE_VAL, false, true);
+}
+
+// Inclusive range
+inline predicate between(std::string column, double min, double max) {
+  return detail::makePredicate(std::move(column), 0, true, min, max, true, true);
+}
+
+inline predicate between(size_t column, double min, double max) {
+  return detail::makePredicate(std::string(), column, false, min, max, true, true);
+}
+
+// Rows are only read if they match all predicates
+class filter {
+ public:
+  filter(predicate condition) : predicates_(1, std::move(condition)) {}
+  filter(std::initializer_list<predicate> predicates) : predicates_(predicates) {}
+  filter(std::vector<predicate> predicates) : predicates_(std::move(predicates)) {}
+
+  inline const std::vector<predicate>& predicates() const { return predicates_; }
+
+ private:
+  std::vector<predicate> predicates_;
+};
+
+// Separator, quote and line ending of a file, as template parameters so every dialect gets its own
+// tokenizer and writer. With crlf, a '\r' before a newline is not part of the field, and rows are
+// written with "\r\n".
+template <char Separator, char Quote = '"', bool Crlf = false>
+struct dialect {
+  static const char separator = Separator;
+  static const char quote = Quote;
+  static const bool crlf = Crlf;
+};
+
+// Used by default everywhere
+typedef dialect<','> csv_dialect;
+typedef dialect<'\t'> tsv_dialect;
+typedef dialect<',', '"', true> crlf_csv_dialect;
+
 namespace detail {
 
 static const std::istreambuf_iterator<char> EOCSVF;
@@ -82,6 +275,283 @@ inline std::string readCsvField(std::istreambuf_iterator<char>& it, bool& new_ro
   return result;
 }
 
+// Field bounds in a raw buffer, excluding surrounding quotes
+struct raw_field {
+  const char* begin;
+  const char* end;
+  bool escaped;  // contains quotes that unescapeCsvField must collapse
+  bool quoted;  // started with a quote
+};
+
+// Empty field for columns past the end of a row. begin and end point into the same object, so
+// end - begin is 0 on every compiler.
+inline const raw_field& missingField() {
+  static const char nothing = '\0';
+  static const raw_field missing = {&nothing, &nothing, false, false};
+  return missing;
+}
+
+// Bit masks of the structural characters in a 64 byte block, bit i is set if block[i] matches
+struct block_masks {
+  uint64_t quotes;
+  uint64_t separators;  // ',' and '\n'
+};
+
+typedef block_masks (*block_scanner)(const char* block);
+
+template <typename Dialect>
+inline block_masks scanBlockScalar(const char* block) {
+  block_masks masks = {0, 0};
+  for (size_t i = 0; i < 64; i++) {
+    char c = block[i];
+    masks.quotes |= static_cast<uint64_t>(c == Dialect::quote) << i;
+    masks.separators |= static_cast<uint64_t>(c == Dialect::separator || c == '\n') << i;
+  }
+  return masks;
+}
+
+#ifdef PH_CSV_X86
+
+template <typename Dialect>
+inline block_masks scanBlockSse2(const char* block) {
+  const __m128i quote = _mm_set1_epi8(Dialect::quote);
+  const __m128i comma = _mm_set1_epi8(Dialect::separator);
+  const __m128i newline = _mm_set1_epi8('\n');
+  block_masks masks = {0, 0};
+  for (size_t i = 0; i < 4; i++) {
+    __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 16 * i));
+    uint64_t quotes = static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chars, quote)));
+    uint64_t separators = static_cast<uint16_t>(_mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(chars, comma), _mm_cmpeq_epi8(chars, newline))));
+    masks.quotes |= quotes << (16 * i);
+    masks.separators |= separators << (16 * i);
+  }
+  return masks;
+}
+
+template <typename Dialect>
+__attribute__((target("avx2"))) inline block_masks scanBlockAvx2(const char* block) {
+  const __m256i quote = _mm256_set1_epi8(Dialect::quote);
+  const __m256i comma = _mm256_set1_epi8(Dialect::separator);
+  const __m256i newline = _mm256_set1_epi8('\n');
+  block_masks masks = {0, 0};
+  for (size_t i = 0; i < 2; i++) {
+    __m256i chars = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 32 * i));
+    uint64_t quotes = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chars, quote)));
+    uint64_t separators = static_cast<uint32_t>(_mm256_movemask_epi8(
+        _mm256_or_si256(_mm256_cmpeq_epi8(chars, comma), _mm256_cmpeq_epi8(chars, newline))));
+    masks.quotes |= quotes << (32 * i);
+    masks.separators |= separators << (32 * i);
+  }
+  return masks;
+}
+
+#endif  // PH_CSV_X86
+
+enum class simd {
+  none,
+  sse2,
+  avx2
+};
+
+inline bool simdSupported(simd level) {
+  switch (level) {
+    case simd::none:
+      return true;
+#ifdef PH_CSV_X86
+    case simd::sse2:
+      return true;
+    case simd::avx2:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx2");
+#endif
+    default:
+      return false;
+  }
+}
+
+inline simd& activeSimd() {
+#ifdef PH_CSV_X86
+  static simd level = simdSupported(simd::avx2) ? simd::avx2 : simd::sse2;
+#else
+  static simd level = simd::none;
+#endif
+  return level;
+}
+
+template <typename Dialect>
+inline block_scanner blockScanner() {
+  switch (activeSimd()) {
+#ifdef PH_CSV_X86
+    case simd::avx2:
+      return scanBlockAvx2<Dialect>;
+    case simd::sse2:
+      return scanBlockSse2<Dialect>;
+#endif
+    default:
+      return scanBlockScalar<Dialect>;
+  }
+}
+
+// Selects the block scanner used by tokenizers created after the call, the best supported
+// level is used by default. Returns false if the level is not supported on this machine.
+inline bool useSimd(simd level) {
+  if (!simdSupported(level)) {
+    return false;
+  }
+  activeSimd() = level;
+  return true;
+}
+
+// Splits a buffer into raw fields with the same rules as readCsvField, 64 bytes at a time.
+// If eof is false, fields that reach the end of the buffer are incomplete and need more input.
+template <typename Dialect = csv_dialect>
+class basic_tokenizer {
+ public:
+  basic_tokenizer(const char* begin, const char* end, bool eof)
+    : pos_(begin), end_(end), eof_(eof), block_(nullptr), masks_(), scanner_(blockScanner<Dialect>()) {}
+
+  inline const char* position() const { return pos_; }
+  inline bool done() const { return pos_ == end_; }
+
+  // Moves back to an earlier position in the buffer, typically the start of an incomplete row
+  inline void seek(const char* pos) { pos_ = pos; }
+
+  // Scans the field at the current position. Returns false, without moving, if the
+  // field is incomplete.
+  bool next(raw_field& field, bool& new_row) {
+    new_row = false;
+    size_t quotes = 0;
+    if (pos_ == end_ || *pos_ != Dialect::quote) {
+      const char* separator = findSeparator(pos_, quotes);
+      if (separator == end_ && !eof_) {
+        return false;
+      }
+      field.begin = pos_;
+      field.end = fieldEnd(pos_, separator);
+      field.escaped = quotes > 0;
+      field.quoted = false;
+      pos_ = finish(separator, new_row);
+      return true;
+    }
+    const char* begin = pos_ + 1;
+    const char* pos = begin;
+    while (true) {
+      const char* separator = findSeparator(pos, quotes);
+      const char* end = fieldEnd(begin, separator);
+      size_t run = 0;  // an odd number of quotes before a separator closes the field
+      for (const char* it = end; it != begin && *(it - 1) == Dialect::quote; it--) {
+        run++;
+      }
+      if (separator == end_) {
+        if (!eof_) {
+          return false;
+        }
+        field.escaped = quotes > run % 2;
+      } else if (run % 2 == 1) {
+        field.escaped = quotes > 1;
+      } else {
+        pos = separator + 1;
+        continue;
+      }
+      field.begin = begin;
+      field.end = end - run % 2;
+      field.quoted = true;
+      pos_ = finish(separator, new_row);
+      return true;
+    }
+  }
+
+ private:
+  // Excludes the '\r' of a "\r\n" line ending
+  inline const char* fieldEnd(const char* begin, const char* separator) const {
+    if (Dialect::crlf && separator != end_ && *separator == '\n' && separator != begin && *(separator - 1) == '\r') {
+      return separator - 1;
+    }
+    return separator;
+  }
+
+  inline const char* finish(const char* separator, bool& new_row) {
+    if (separator == end_) {
+      return end_;
+    }
+    new_row = *separator == '\n';
+    return separator + 1;
+  }
+
+  // Returns the first separator at or after pos, or end_, and counts the quotes before it
+  const char* findSeparator(const char* pos, size_t& quotes) {
+    while (pos < end_) {
+      if (block_ == nullptr || pos < block_ || pos - block_ >= 64) {
+        load(pos);
+      }
+      size_t offset = pos - block_;
+      uint64_t separators = masks_.separators >> offset;
+      uint64_t block_quotes = masks_.quotes >> offset;
+      if (separators != 0) {
+        size_t i = __builtin_ctzll(separators);
+        quotes += __builtin_popcountll(block_quotes & ((uint64_t(1) << i) - 1));
+        return pos + i;
+      }
+      quotes += __builtin_popcountll(block_quotes);
+      pos = end_ - block_ > 64 ? block_ + 64 : end_;
+    }
+    return end_;
+  }
+
+  void load(const char* pos) {
+    block_ = pos;
+    if (end_ - pos >= 64) {
+      masks_ = scanner_(pos);
+    } else {
+      char padded[64] = {};
+      std::memcpy(padded, pos, end_ - pos);
+      masks_ = scanner_(padded);
+    }
+  }
+
+  const char* pos_;
+  const char* end_;
+  bool eof_;
+  const char* block_;
+  block_masks masks_;
+  block_scanner scanner_;
+};
+
+typedef basic_tokenizer<> tokenizer;
+
+// Appends the field to result, collapsing every run of n quotes to (n + 1) / 2 quotes
+// like readCsvField does
+template <typename Dialect = csv_dialect>
+inline void appendCsvField(const raw_field& field, std::string& result) {
+  if (!field.escaped) {
+    result.append(field.begin, field.end);
+    return;
+  }
+  const char* pos = field.begin;
+  while (pos != field.end) {
+    const char* quote = static_cast<const char*>(std::memchr(pos, Dialect::quote, field.end - pos));
+    if (quote == nullptr) {
+      result.append(pos, field.end);
+      break;
+    }
+    result.append(pos, quote);
+    pos = quote;
+    size_t run = 0;
+    while (pos != field.end && *pos == Dialect::quote) {
+      run++;
+      pos++;
+    }
+    result.append((run + 1) / 2, Dialect::quote);
+  }
+}
+
+template <typename Dialect = csv_dialect>
+inline void unescapeCsvField(const raw_field& field, std::string& result) {
+  result.clear();
+  appendCsvField<Dialect>(field, result);
+}
+
 inline std::vector<std::string> readCsvRow(std::istreambuf_iterator<char>& it, size_t reserve = 0) {
   std::vector<std::string> result;
   result.reserve(reserve);
@@ -97,18 +567,146 @@ inline std::vector<std::string> readCsvRow(std::istreambuf_iterator<char>& it, s
   return result;
 }
 
-inline void readStream(std::istream& in, std::vector<std::vector<std::string>>& data, std::vector<std::string>* header = nullptr) {
+// Copies all fields to row, padding it with empty fields to at least min_columns
+template <typename Dialect = csv_dialect>
+inline void copyFields(const std::vector<raw_field>& fields, std::vector<std::string>& row, size_t min_columns) {
+  row.resize(fields.size());
+  for (size_t i = 0; i < fields.size(); i++) {
+    unescapeCsvField<Dialect>(fields[i], row[i]);
+  }
+  row.resize(std::max(fields.size(), min_columns));
+}
+
+// Copies only the given columns to row, in the given order, missing fields are empty
+inline void copyFields(const std::vector<raw_field>& fields, std::vector<std::string>& row, const std::vector<size_t>& columns) {
+  row.resize(columns.size());
+  for (size_t i = 0; i < columns.size(); i++) {
+    if (columns[i] < fields.size()) {
+      unescapeCsvField(fields[columns[i]], row[i]);
+    } else {
+      row[i].clear();
+    }
+  }
+}
+
+// Reads input in large blocks into a reusable buffer, which is split into rows by a tokenizer.
+// Rows spanning blocks are moved to the front of the buffer, which grows if a row doesn't fit.
+template <typename Dialect = csv_dialect>
+class basic_block_reader {
+ public:
+  // Reads up to size bytes into buffer and returns the number of bytes read, 0 at end of input
+  typedef std::function<size_t(char* buffer, size_t size)> read_function;
+
+  basic_block_reader(std::istream& in, size_t block_size = 1 << 16)
+    : basic_block_reader([&in] (char* buffer, size_t size) { return static_cast<size_t>(in.rdbuf()->sgetn(buffer, size)); }, block_size) {}
+
+  // If follow, the end of the input doesn't end the last row: readFields returns false until a
+  // newline completes it, and later calls read the input again, for input that is still growing.
+  basic_block_reader(read_function read, size_t block_size = 1 << 16, bool follow = false)
+    : read_(std::move(read)), buffer_(std::max<size_t>(block_size, 1)), end_(0), eof_(false), follow_(follow), tokenizer_(nullptr, nullptr, false), fields_(), consumed_(0) {}
+
+  // Reads the raw fields of the next row, which point into the buffer and stay valid until
+  // the next call. Returns false at end of stream.
+  bool readFields(std::vector<raw_field>& fields) {
+    while (true) {
+      if (tokenizer_.done() && ((eof_ && !follow_) || !fill())) {
+        return false;
+      }
+      const char* row_begin = tokenizer_.position();
+      fields.clear();
+      bool new_row = false;
+      bool complete = true;
+      raw_field field;
+      while (!tokenizer_.done() && !new_row) {
+        if (!tokenizer_.next(field, new_row)) {
+          complete = false;
+          break;
+        }
+        fields.push_back(field);
+      }
+      if (complete && (new_row || (eof_ && !follow_))) {
+        return true;
+      }
+      tokenizer_.seek(row_begin);
+      if (!fill() && follow_) {
+        return false;
+      }
+    }
+  }
+
+  // Equivalent of readCsvRow, but reuses the strings in row. Returns false at end of stream.
+  bool readRow(std::vector<std::string>& row, size_t min_columns = 0) {
+    if (!readFields(fields_)) {
+      return false;
+    }
+    copyFields<Dialect>(fields_, row, min_columns);
+    return true;
+  }
+
+  // Number of bytes read before the next row, from where the reader started
+  inline uint64_t position() const {
+    return consumed_ + (tokenizer_.position() == nullptr ? 0 : tokenizer_.position() - buffer_.data());
+  }
+
+ private:
+  // Keeps the unparsed part of the buffer and reads more after it. Returns false at end of stream.
+  bool fill() {
+    size_t begin = tokenizer_.position() == nullptr ? 0 : tokenizer_.position() - buffer_.data();
+    std::memmove(buffer_.data(), buffer_.data() + begin, end_ - begin);
+    end_ -= begin;
+    consumed_ += begin;
+    if (end_ == buffer_.size()) {
+      buffer_.resize(buffer_.size() * 2);
+    }
+    size_t read = read_(buffer_.data() + end_, buffer_.size() - end_);
+    end_ += read;
+    eof_ = read == 0;
+    tokenizer_ = basic_tokenizer<Dialect>(buffer_.data(), buffer_.data() + end_, eof_ && !follow_);
+    return !eof_;
+  }
+
+  read_function read_;
+  std::vector<char> buffer_;
+  size_t end_;
+  bool eof_;
+  bool follow_;
+  basic_tokenizer<Dialect> tokenizer_;
+  std::vector<raw_field> fields_;
+  uint64_t consumed_;  // bytes moved out of the buffer
+};
+
+typedef basic_block_reader<> block_reader;
+
+// Appends a row to a table whose fields use another allocator, such as pH::csv::arena_flat
+template <typename Table>
+inline void appendRow(Table& data, std::vector<std::string>& row) {
+  typedef typename Table::value_type::value_type field_type;
+  typename field_type::allocator_type allocator(data.get_allocator());
+  data.emplace_back(allocator);
+  auto& result = data.back();
+  result.reserve(row.size());
+  for (const auto& field : row) {
+    result.emplace_back(field.data(), field.size(), allocator);
+  }
+}
+
+inline void appendRow(std::vector<std::vector<std::string>>& data, std::vector<std::string>& row) {
+  data.push_back(std::move(row));
+}
+
+template <typename Dialect = csv_dialect, typename Table>
+inline void readStream(std::istream& in, Table& data, std::vector<std::string>* header = nullptr) {
   if (in.bad() || in.fail()) {
     throw std::runtime_error("Bad input");
   }
-  std::istreambuf_iterator<char> it(in);
+  basic_block_reader<Dialect> reader(in);
   size_t header_size = 0;
-  if (header != nullptr && it != detail::EOCSVF) {
-    *header = detail::readCsvRow(it);
+  if (header != nullptr && reader.readRow(*header)) {
     header_size = header->size();
   }
-  while (it != detail::EOCSVF) {
-    data.push_back(detail::readCsvRow(it, header_size));
+  std::vector<std::string> row;
+  while (reader.readRow(row, header_size)) {
+    appendRow(data, row);
   }
 }
 
@@ -145,20 +743,76 @@ inline void writeCsvRow(std::ostreambuf_iterator<char>& it, const std::vector<st
   }
 }
 
-void writeStream(std::ostream& out, const std::vector<std::vector<std::string>>& data, const std::vector<std::string>* header = nullptr) {
-  if (out.bad() || out.fail()) {
-    throw std::runtime_error("Bad output");
+// True if the field contains a separator or a quote, like the check in writeCsvRow. Checks 16
+// bytes at a time with SSE2, or 8 bytes at a time in a 64 bit word on other platforms.
+template <typename Dialect = csv_dialect>
+inline bool needsEscape(const char* data, size_t size) {
+  size_t i = 0;
+#ifdef PH_CSV_X86
+  const __m128i separator = _mm_set1_epi8(Dialect::separator);
+  const __m128i quote = _mm_set1_epi8(Dialect::quote);
+  for (; i + 16 <= size; i += 16) {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    if (_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, separator), _mm_cmpeq_epi8(block, quote))) != 0) {
+      return true;
+    }
   }
-  std::ostreambuf_iterator<char> it(out);
-  if (header != nullptr) {
-    detail::writeCsvRow(it, *header);
-    it = '\n';
+#else
+  const uint64_t ones = 0x0101010101010101ull;
+  const uint64_t highs = 0x8080808080808080ull;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, data + i, 8);
+    uint64_t separators = word ^ (ones * static_cast<unsigned char>(Dialect::separator));
+    uint64_t quotes = word ^ (ones * static_cast<unsigned char>(Dialect::quote));
+    if ((((separators - ones) & ~separators) | ((quotes - ones) & ~quotes)) & highs) {
+      return true;
+    }
+  }
+#endif
+  for (; i < size; i++) {
+    if (data[i] == Dialect::separator || data[i] == Dialect::quote) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Appends the field to out, quoted with doubled quotes if needed, with the same output as writeCsvRow
+template <typename Dialect = csv_dialect>
+inline void formatCsvField(const char* data, size_t size, std::string& out) {
+  if (size == 0) {
+    return;
+  }
+  if (!needsEscape<Dialect>(data, size)) {
+    out.append(data, size);
+    return;
+  }
+  const char* end = data + size;
+  out += Dialect::quote;
+  while (true) {
+    const char* quote = static_cast<const char*>(std::memchr(data, Dialect::quote, end - data));
+    if (quote == nullptr) {
+      out.append(data, end);
+      break;
+    }
+    out.append(data, quote + 1);
+    out += Dialect::quote;
+    data = quote + 1;
   }
-  for (size_t i = 0; i < data.size(); i++) {
-    detail::writeCsvRow(it, data.at(i));
-    if (i != data.size() - 1) {
-      it = '\n';
+  out += Dialect::quote;
+}
+
+// Appends the fields of row separated by commas, fields can be std::strings or views
+template <typename Dialect = csv_dialect, typename Row>
+inline void formatCsvRow(const Row& row, std::string& out) {
+  bool first = true;
+  for (const auto& field : row) {
+    if (!first) {
+      out += Dialect::separator;
     }
+    first = false;
+    formatCsvField<Dialect>(field.data(), field.size(), out);
   }
 }
 
@@ -171,213 +825,3764 @@ inline size_t headerIndex(const std::vector<std::string>& header, const std::str
   throw std::runtime_error("Unrecognized column " + column);
 }
 
-template<typename T>
-inline T convert(const std::string& str) {
-  return T(str);  // hope it's constructible with a string...
-}
-template <> inline std::string convert(const std::string& str) { return str; }
-template <> inline double convert(const std::string& str) { return std::stod(str); }
-template <> inline float convert(const std::string& str) { return std::stof(str); }
-template <> inline int convert(const std::string& str) { return std::stoi(str); }
-template <> inline size_t convert(const std::string& str) { return static_cast<size_t>(std::stoul(str)); }
-
-}  // namespace detail
-
-class flat {
+// Hashed equivalent of headerIndex, built once per header
+class header_map {
  public:
-  flat() : data_(), columns_(0) {}
-
-  flat(std::istream& in) : data_(), columns_(0) {
-    read(in);
-  }
+  header_map() : indices_() {}
+  explicit header_map(const std::vector<std::string>& header) : indices_() { assign(header); }
 
-  flat(const std::string& filename) : data_(), columns_(0) {
-    std::ifstream in(filename, std::ios::in | std::ios::binary);
-    read(in);
+  void assign(const std::vector<std::string>& header) {
+    indices_.clear();
+    indices_.reserve(header.size());
+    for (size_t i = 0; i < header.size(); i++) {
+      indices_.emplace(header[i], i);  // keeps the first of duplicate columns, like headerIndex
+    }
   }
 
-  virtual void write(std::ostream& out) const {
-    detail::writeStream(out, data_);
+  inline size_t at(const std::string& column) const {
+    auto it = indices_.find(column);
+    if (it == indices_.end()) {
+      throw std::runtime_error("Unrecognized column " + column);
+    }
+    return it->second;
   }
 
-  virtual void write(const std::string& filename) const {
-    std::ofstream out(filename, std::ios::out | std::ios::binary);
-    detail::writeStream(out, data_);
-  }
+ private:
+  std::unordered_map<std::string, size_t> indices_;
+};
 
-  inline size_t rows() const { return data_.size(); }
-  virtual inline size_t columns() const { return columns_; }
-  inline size_t columns(size_t row) const { return data_.at(row).size(); }
+inline bool isSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+}
 
-  inline std::string& at(size_t row, size_t column) { return data_.at(row).at(column); }
-  inline const std::string& at(size_t row, size_t column) const { return data_.at(row).at(column); }
+inline void trimSpace(const char*& begin, const char*& end) {
+  while (begin != end && isSpace(*begin)) {
+    begin++;
+  }
+  while (begin != end && isSpace(*(end - 1))) {
+    end--;
+  }
+}
 
-  void emplaceRow(size_t columns) { data_.emplace_back(columns); }
-  virtual void emplaceRow() { data_.emplace_back(columns_); }
+inline bool isDigit(char c) { return static_cast<unsigned char>(c - '0') < 10; }
 
-  virtual void resizeColumns(size_t size) {
-    columns_ = size;
-    for (auto& row : data_) {
-      row.resize(size);
+template <typename T>
+inline conversion_error parseInteger(const char* begin, const char* end, T& result) {
+  trimSpace(begin, end);
+  if (begin == end) {
+    return conversion_error::empty;
+  }
+  bool negative = *begin == '-';
+  if (*begin == '-' || *begin == '+') {
+    begin++;
+  }
+  if (begin == end || (negative && !std::is_signed<T>::value)) {
+    return conversion_error::invalid;
+  }
+  uint64_t value = 0;
+  bool overflow = false;
+  for (; begin != end; begin++) {
+    if (!isDigit(*begin)) {
+      return conversion_error::invalid;
     }
+    uint64_t digit = *begin - '0';
+    overflow = overflow || value > (std::numeric_limits<uint64_t>::max() - digit) / 10;
+    value = value * 10 + digit;
   }
+  uint64_t max = static_cast<uint64_t>(std::numeric_limits<T>::max());
+  if (overflow || value > max + (negative ? 1 : 0)) {
+    return conversion_error::out_of_range;
+  }
+  // Negate without overflowing for the minimum value
+  result = negative && value != 0 ? static_cast<T>(-static_cast<T>(value - 1) - 1) : static_cast<T>(value);
+  return conversion_error::none;
+}
 
-  template <typename T = std::string>
-  inline T get(size_t row, size_t column) const {
-    return detail::convert<T>(data_.at(row).at(column));
+inline conversion_error parseBool(const char* begin, const char* end, bool& result) {
+  trimSpace(begin, end);
+  std::string lower;
+  for (; begin != end && lower.size() < 5; begin++) {
+    lower.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(*begin))));
+  }
+  if (lower.empty()) {
+    return conversion_error::empty;
   }
+  if (begin == end && (lower == "1" || lower == "true")) {
+    result = true;
+  } else if (begin == end && (lower == "0" || lower == "false")) {
+    result = false;
+  } else {
+    return conversion_error::invalid;
+  }
+  return conversion_error::none;
+}
 
-  bool operator==(const flat& other) const { return data_ == other.data_; }
-  bool operator!=(const flat& other) const { return !(*this == other); }
+// Powers of five from 5^-342 to 5^308, each as a normalized 128 bit mantissa (high word first),
+// truncated for positive and rounded up for negative exponents. Computed once with big integers.
+class power_of_five_table {
+ public:
+  static constexpr int smallest_power = -342;
+  static constexpr int largest_power = 308;
 
-  virtual ~flat() = default;
+  power_of_five_table() {
+    std::vector<uint32_t> value(1, 1);
+    for (int q = 0; q <= largest_power; q++) {
+      store(q, value, false);
+      multiplyBy5(value);
+    }
+    value.assign(37, 0);  // 2^1152, enough for 128 significant bits of 2^1152 / 5^342
+    value.back() = 1;
+    for (int q = -1; q >= smallest_power; q--) {
+      divideBy5(value);
+      store(q, value, true);
+    }
+  }
 
- protected:
-  std::vector<std::vector<std::string>> data_;
+  inline const uint64_t* at(int q) const { return &values_[2 * (q - smallest_power)]; }
 
  private:
-  void read(std::istream& in) {
-    detail::readStream(in, data_);
-    for (const auto& row : data_) {
-      columns_ = std::max(columns_, row.size());
+  static void multiplyBy5(std::vector<uint32_t>& value) {
+    uint64_t carry = 0;
+    for (uint32_t& limb : value) {
+      carry += static_cast<uint64_t>(limb) * 5;
+      limb = static_cast<uint32_t>(carry);
+      carry >>= 32;
+    }
+    if (carry != 0) {
+      value.push_back(static_cast<uint32_t>(carry));
     }
   }
 
-  size_t columns_;
-};
-
-class mapped_row {
- public:
-  mapped_row(const std::vector<std::string>& header, const std::vector<std::string>& data) : header_(header), data_(data) {}
-  mapped_row() = delete;
-  mapped_row(const mapped_row& other) = delete;
-  mapped_row(mapped_row&& other) = delete;
-  mapped_row& operator=(const mapped_row& other) = delete;
-  mapped_row& operator=(mapped_row&& other) = delete;
-
-  inline size_t size() const { return data_.size(); }
-
-  inline const std::string& at(const std::string& column) const {
-    return data_[detail::headerIndex(header_, column)];
+  static void divideBy5(std::vector<uint32_t>& value) {
+    uint64_t remainder = 0;
+    for (size_t i = value.size(); i-- > 0;) {
+      uint64_t current = (remainder << 32) | value[i];
+      value[i] = static_cast<uint32_t>(current / 5);
+      remainder = current % 5;
+    }
+    while (value.size() > 1 && value.back() == 0) {
+      value.pop_back();
+    }
+  }
+
+  // Returns the 64 bits of value starting at bit start, bits outside value are zero
+  static uint64_t bits(const std::vector<uint32_t>& value, int64_t start) {
+    uint64_t result = 0;
+    for (int64_t i = 0; i < 64; i++) {
+      int64_t bit = start + i;
+      if (bit >= 0 && bit < static_cast<int64_t>(32 * value.size())) {
+        result |= static_cast<uint64_t>((value[bit / 32] >> (bit % 32)) & 1) << i;
+      }
+    }
+    return result;
+  }
+
+  void store(int q, const std::vector<uint32_t>& value, bool round_up) {
+    int64_t length = 32 * static_cast<int64_t>(value.size());
+    for (uint32_t top = value.back(); (top & 0x80000000u) == 0; top <<= 1) {
+      length--;
+    }
+    uint64_t high = bits(value, length - 64);
+    uint64_t low = bits(value, length - 128);
+    if (round_up && ++low == 0) {
+      high++;
+    }
+    values_[2 * (q - smallest_power)] = high;
+    values_[2 * (q - smallest_power) + 1] = low;
+  }
+
+  uint64_t values_[2 * (largest_power - smallest_power + 1)];
+};
+
+inline const power_of_five_table& powersOfFive() {
+  static const power_of_five_table table;
+  return table;
+}
+
+inline void multiply64(uint64_t a, uint64_t b, uint64_t& high, uint64_t& low) {
+  uint64_t a_low = a & 0xFFFFFFFFu;
+  uint64_t a_high = a >> 32;
+  uint64_t b_low = b & 0xFFFFFFFFu;
+  uint64_t b_high = b >> 32;
+  uint64_t low_low = a_low * b_low;
+  uint64_t high_low = a_high * b_low;
+  uint64_t low_high = a_low * b_high;
+  uint64_t cross = (low_low >> 32) + (high_low & 0xFFFFFFFFu) + low_high;
+  high = a_high * b_high + (high_low >> 32) + (cross >> 32);
+  low = (cross << 32) | (low_low & 0xFFFFFFFFu);
+}
+
+template <typename T> struct float_traits;
+
+template <> struct float_traits<double> {
+  typedef uint64_t bits;
+  static constexpr int mantissa_bits = 52;
+  static constexpr int minimum_exponent = -1023;
+  static constexpr int infinite_power = 0x7FF;
+  static constexpr int min_round_to_even = -4;
+  static constexpr int max_round_to_even = 23;
+  static constexpr int smallest_power = -342;
+  static constexpr int largest_power = 308;
+  static constexpr int max_fast_exponent = 22;
+  static constexpr uint64_t max_fast_mantissa = uint64_t(2) << 52;
+  static constexpr int sign_bit = 63;
+  static inline double exactPowerOfTen(int e) {
+    static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    return powers[e];
+  }
+};
+
+template <> struct float_traits<float> {
+  typedef uint32_t bits;
+  static constexpr int mantissa_bits = 23;
+  static constexpr int minimum_exponent = -127;
+  static constexpr int infinite_power = 0xFF;
+  static constexpr int min_round_to_even = -17;
+  static constexpr int max_round_to_even = 10;
+  static constexpr int smallest_power = -65;
+  static constexpr int largest_power = 38;
+  static constexpr int max_fast_exponent = 10;
+  static constexpr uint64_t max_fast_mantissa = uint64_t(2) << 23;
+  static constexpr int sign_bit = 31;
+  static inline float exactPowerOfTen(int e) {
+    static const float powers[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+    return powers[e];
+  }
+};
+
+// Binary mantissa and biased exponent of a float, power2 is -1 if the result can't be decided
+struct adjusted_mantissa {
+  uint64_t mantissa;
+  int power2;
+  bool operator==(const adjusted_mantissa& other) const { return mantissa == other.mantissa && power2 == other.power2; }
+};
+
+// Correctly rounded w * 10^q for normal numbers with the Eisel-Lemire algorithm
+template <typename T>
+inline adjusted_mantissa computeFloat(int64_t q, uint64_t w) {
+  typedef float_traits<T> traits;
+  adjusted_mantissa answer = {0, 0};
+  if (w == 0 || q < traits::smallest_power) {
+    return answer;
+  }
+  if (q > traits::largest_power) {
+    answer.power2 = traits::infinite_power;
+    return answer;
+  }
+  int leading_zeros = __builtin_clzll(w);
+  w <<= leading_zeros;
+  const uint64_t* power = powersOfFive().at(static_cast<int>(q));
+  uint64_t high, low;
+  multiply64(w, power[0], high, low);
+  const uint64_t precision_mask = ~uint64_t(0) >> (traits::mantissa_bits + 3);
+  if ((high & precision_mask) == precision_mask) {
+    uint64_t second_high, second_low;
+    multiply64(w, power[1], second_high, second_low);
+    low += second_high;
+    if (second_high > low) {
+      high++;
+    }
+    if (low == ~uint64_t(0) && (q < -27 || q > 55)) {
+      answer.power2 = -1;
+      return answer;
+    }
+  }
+  int upper_bit = static_cast<int>(high >> 63);
+  int shift = upper_bit + 64 - traits::mantissa_bits - 3;
+  answer.mantissa = high >> shift;
+  answer.power2 = static_cast<int>((((152170 + 65536) * q) >> 16) + 63) + upper_bit - leading_zeros - traits::minimum_exponent;
+  if (answer.power2 <= 0) {
+    answer.power2 = -1;  // subnormal
+    return answer;
+  }
+  // Round to even when exactly halfway, which is only possible for small exponents
+  if (low <= 1 && q >= traits::min_round_to_even && q <= traits::max_round_to_even && (answer.mantissa & 3) == 1 &&
+      (answer.mantissa << shift) == high) {
+    answer.mantissa &= ~uint64_t(1);
+  }
+  answer.mantissa += answer.mantissa & 1;
+  answer.mantissa >>= 1;
+  if (answer.mantissa >= (uint64_t(2) << traits::mantissa_bits)) {
+    answer.mantissa = uint64_t(1) << traits::mantissa_bits;
+    answer.power2++;
+  }
+  answer.mantissa &= ~(uint64_t(1) << traits::mantissa_bits);
+  if (answer.power2 >= traits::infinite_power) {
+    answer.power2 = traits::infinite_power;
+    answer.mantissa = 0;
+  }
+  return answer;
+}
+
+inline bool matchesIgnoreCase(const char* begin, const char* end, const char* word) {
+  for (; begin != end && *word != '\0'; begin++, word++) {
+    if (std::tolower(static_cast<unsigned char>(*begin)) != *word) {
+      return false;
+    }
+  }
+  return begin == end && *word == '\0';
+}
+
+// Locale independent and correctly rounded float parsing. Exact cases are computed directly,
+// most others with the Eisel-Lemire algorithm and the remaining rare ones with std::istream.
+template <typename T>
+inline conversion_error parseFloat(const char* begin, const char* end, T& result) {
+  typedef float_traits<T> traits;
+  trimSpace(begin, end);
+  if (begin == end) {
+    return conversion_error::empty;
+  }
+  const char* token = begin;
+  bool negative = *begin == '-';
+  if (*begin == '-' || *begin == '+') {
+    begin++;
+  }
+  if (matchesIgnoreCase(begin, end, "inf") || matchesIgnoreCase(begin, end, "infinity")) {
+    result = negative ? -std::numeric_limits<T>::infinity() : std::numeric_limits<T>::infinity();
+    return conversion_error::none;
+  }
+  if (matchesIgnoreCase(begin, end, "nan")) {
+    result = std::numeric_limits<T>::quiet_NaN();
+    return conversion_error::none;
+  }
+
+  // Keeps the first 19 significant digits in w, which always fits in 64 bits
+  uint64_t w = 0;
+  int64_t q = 0;
+  int digits = 0;
+  bool any_digit = false;
+  bool truncated = false;
+  for (; begin != end && isDigit(*begin); begin++) {
+    any_digit = true;
+    if (digits < 19) {
+      w = w * 10 + (*begin - '0');
+      digits += w != 0;
+    } else {
+      q++;
+      truncated = truncated || *begin != '0';
+    }
+  }
+  if (begin != end && *begin == '.') {
+    for (begin++; begin != end && isDigit(*begin); begin++) {
+      any_digit = true;
+      if (digits < 19) {
+        w = w * 10 + (*begin - '0');
+        digits += w != 0;
+        q--;
+      } else {
+        truncated = truncated || *begin != '0';
+      }
+    }
+  }
+  if (!any_digit) {
+    return conversion_error::invalid;
+  }
+  if (begin != end && (*begin == 'e' || *begin == 'E')) {
+    begin++;
+    bool negative_exponent = begin != end && *begin == '-';
+    if (begin != end && (*begin == '-' || *begin == '+')) {
+      begin++;
+    }
+    if (begin == end) {
+      return conversion_error::invalid;
+    }
+    int64_t exponent = 0;
+    for (; begin != end && isDigit(*begin); begin++) {
+      if (exponent < 100000) {
+        exponent = exponent * 10 + (*begin - '0');
+      }
+    }
+    q += negative_exponent ? -exponent : exponent;
+  }
+  if (begin != end) {
+    return conversion_error::invalid;
+  }
+
+  if (w == 0) {
+    result = negative ? -T(0) : T(0);
+    return conversion_error::none;
+  }
+#if FLT_EVAL_METHOD == 0
+  if (!truncated && w <= traits::max_fast_mantissa && q >= -traits::max_fast_exponent && q <= traits::max_fast_exponent) {
+    T value = static_cast<T>(w);
+    value = q < 0 ? value / traits::exactPowerOfTen(static_cast<int>(-q)) : value * traits::exactPowerOfTen(static_cast<int>(q));
+    result = negative ? -value : value;
+    return conversion_error::none;
+  }
+#endif
+  adjusted_mantissa answer = computeFloat<T>(q, w);
+  if (truncated && answer.power2 >= 0 && !(computeFloat<T>(q, w + 1) == answer)) {
+    answer.power2 = -1;
+  }
+  if (answer.power2 < 0) {
+    std::istringstream in(std::string(token, end));
+    in.imbue(std::locale::classic());
+    in >> result;
+    return in.fail() ? conversion_error::out_of_range : conversion_error::none;
+  }
+  if (answer.power2 == traits::infinite_power) {
+    return conversion_error::out_of_range;
+  }
+  typename traits::bits bits = static_cast<typename traits::bits>(
+      answer.mantissa | (static_cast<uint64_t>(answer.power2) << traits::mantissa_bits) |
+      (static_cast<uint64_t>(negative) << traits::sign_bit));
+  std::memcpy(&result, &bits, sizeof(result));
+  return conversion_error::none;
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value, conversion_error>::type parseValue(const char* begin, const char* end, T& result) {
+  return parseInteger(begin, end, result);
+}
+
+inline conversion_error parseValue(const char* begin, const char* end, bool& result) {
+  return parseBool(begin, end, result);
+}
+
+inline conversion_error parseValue(const char* begin, const char* end, double& result) {
+  return parseFloat(begin, end, result);
+}
+
+inline conversion_error parseValue(const char* begin, const char* end, float& result) {
+  return parseFloat(begin, end, result);
+}
+
+inline conversion_error parseValue(const char* begin, const char* end, long double& result) {
+  trimSpace(begin, end);
+  if (begin == end) {
+    return conversion_error::empty;
+  }
+  std::istringstream in(std::string(begin, end));
+  in.imbue(std::locale::classic());
+  in >> result;
+  if (in.fail() || in.peek() != std::char_traits<char>::eof()) {
+    return conversion_error::invalid;
+  }
+  return conversion_error::none;
+}
+
+inline conversion_error parseValue(const char* begin, const char* end, std::string& result) {
+  result.assign(begin, end);
+  return conversion_error::none;
+}
+
+inline void throwConversionError(conversion_error error, const view& str) {
+  switch (error) {
+    case conversion_error::none:
+      return;
+    case conversion_error::out_of_range:
+      throw std::out_of_range("Value out of range: " + str.str());
+    default:
+      throw std::invalid_argument("Unable to convert \"" + str.str() + "\"");
+  }
+}
+
+template <typename T, typename Enable = void>
+struct converter {
+  static T convert(const view& str) {
+    return T(str.str());  // hope it's constructible with a string...
+  }
+};
+
+template <>
+struct converter<std::string> {
+  static std::string convert(const view& str) { return str.str(); }
+};
+
+template <typename T>
+struct converter<T, typename std::enable_if<std::is_arithmetic<T>::value>::type> {
+  static T convert(const view& str) {
+    T result = T();
+    throwConversionError(parseValue(str.begin(), str.end(), result), str);
+    return result;
+  }
+};
+
+// Converts a field to T, throwing std::invalid_argument or std::out_of_range on failure
+template <typename T>
+inline T convert(const view& str) {
+  return converter<T>::convert(str);
+}
+
+// As above, but empty fields are converted to empty_value
+template <typename T>
+inline T convert(const view& str, const T& empty_value) {
+  return str.empty() ? empty_value : converter<T>::convert(str);
+}
+
+// Parses a raw field directly into result. Scratch is only used for escaped fields.
+template <typename T>
+inline typename std::enable_if<std::is_arithmetic<T>::value>::type parseField(const raw_field& field, T& result, std::string& scratch) {
+  if (field.escaped) {
+    unescapeCsvField(field, scratch);
+    result = convert<T>(scratch);
+  } else {
+    result = convert<T>(view(field.begin, field.end - field.begin));
+  }
+}
+
+inline void parseField(const raw_field& field, std::string& result, std::string& /* scratch */) {
+  unescapeCsvField(field, result);
+}
+
+template <typename T>
+inline typename std::enable_if<!std::is_arithmetic<T>::value>::type parseField(const raw_field& field, T& result, std::string& scratch) {
+  unescapeCsvField(field, scratch);
+  result = convert<T>(scratch);
+}
+
+// Appends the decimal digits of an integer, two at a time
+template <typename T>
+inline void formatInteger(T value, std::string& out) {
+  static const char pairs[] =
+      "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+      "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+      "8081828384858687888990919293949596979899";
+  typedef typename std::make_unsigned<T>::type unsigned_type;
+  unsigned_type magnitude = static_cast<unsigned_type>(value);
+  if (std::is_signed<T>::value && value < T(0)) {
+    out += '-';
+    magnitude = static_cast<unsigned_type>(0 - magnitude);
+  }
+  char buffer[24];
+  char* end = buffer + sizeof(buffer);
+  char* begin = end;
+  while (magnitude >= 100) {
+    const char* pair = pairs + 2 * (magnitude % 100);
+    magnitude /= 100;
+    *--begin = pair[1];
+    *--begin = pair[0];
+  }
+  if (magnitude >= 10) {
+    const char* pair = pairs + 2 * magnitude;
+    *--begin = pair[1];
+    *--begin = pair[0];
+  } else {
+    *--begin = static_cast<char>('0' + magnitude);
+  }
+  out.append(begin, end);
+}
+
+inline void printScientific(char* buffer, size_t size, int precision, double value) {
+  std::snprintf(buffer, size, "%.*e", precision, value);
+}
+
+inline void printScientific(char* buffer, size_t size, int precision, long double value) {
+  std::snprintf(buffer, size, "%.*Le", precision, value);
+}
+
+// Prints value correctly rounded to precision significant digits, and returns the digits and the
+// decimal exponent of d.ddd...e+x, skipping the locale's decimal point
+template <typename T>
+inline void printDigits(T value, int precision, char* digits, int& exponent) {
+  typedef typename std::conditional<std::is_same<T, long double>::value, long double, double>::type print_type;
+  char buffer[64];
+  printScientific(buffer, sizeof(buffer), precision - 1, static_cast<print_type>(value));
+  const char* p = buffer;
+  for (; *p != 'e'; p++) {
+    if (isDigit(*p)) {
+      *digits++ = *p;
+    }
+  }
+  bool negative = *++p == '-';
+  exponent = 0;
+  for (p++; isDigit(*p); p++) {
+    exponent = exponent * 10 + (*p - '0');
+  }
+  exponent = negative ? -exponent : exponent;
+}
+
+// Appends count significant digits, the first at 10^exponent, in the layout of formatFloat
+inline void appendFloatDigits(const char* digits, int count, int exponent, int max_digits, std::string& out) {
+  if (exponent < -4 || exponent >= max_digits - 1) {
+    out += digits[0];
+    if (count > 1) {
+      out += '.';
+      out.append(digits + 1, count - 1);
+    }
+    out += exponent < 0 ? "e-" : "e+";
+    if (std::abs(exponent) < 10) {
+      out += '0';
+    }
+    formatInteger(std::abs(exponent), out);
+  } else if (exponent < 0) {
+    out += "0.";
+    out.append(-exponent - 1, '0');
+    out.append(digits, count);
+  } else if (count <= exponent + 1) {
+    out.append(digits, count);
+    out.append(exponent + 1 - count, '0');
+  } else {
+    out.append(digits, exponent + 1);
+    out += '.';
+    out.append(digits + exponent + 1, count - exponent - 1);
+  }
+}
+
+// Appends the shortest decimal representation that parses back to the same value. The digits are
+// printed once with max_digits10 precision and rounded to the fewest digits that round-trip, and
+// the output is the same in every locale: "0.1", "1e+20", "-inf" or "nan".
+template <typename T>
+inline void formatFloat(T value, std::string& out) {
+  const int max_digits = std::numeric_limits<T>::max_digits10;
+  if (std::isnan(value)) {
+    out += "nan";
+    return;
+  }
+  if (std::signbit(value)) {
+    out += '-';
+    value = -value;
+  }
+  if (std::isinf(value)) {
+    out += "inf";
+    return;
+  }
+  if (value == 0) {
+    out += '0';
+    return;
+  }
+  char digits[max_digits];
+  int exponent = 0;
+  printDigits(value, max_digits, digits, exponent);
+  int count = max_digits;
+
+  // Representations with fewer than digits10 digits show up as trailing zeros, except for subnormal
+  // numbers, which have less precision
+  int shortest = value < std::numeric_limits<T>::min() ? 1 : std::numeric_limits<T>::digits10;
+  for (int precision = shortest; precision < max_digits; precision++) {
+    char rounded[max_digits];
+    int rounded_exponent = exponent;
+    char* tail = digits + precision;
+    if (*tail == '5' && std::all_of(tail + 1, digits + max_digits, [](char c) { return c == '0'; })) {
+      // Rounding the rounded digits again could go the wrong way
+      printDigits(value, precision, rounded, rounded_exponent);
+    } else {
+      std::memcpy(rounded, digits, precision);
+      if (*tail >= '5') {
+        int i = precision - 1;
+        for (; i >= 0 && rounded[i] == '9'; i--) {
+          rounded[i] = '0';
+        }
+        if (i >= 0) {
+          rounded[i]++;
+        } else {
+          rounded[0] = '1';
+          rounded_exponent++;
+        }
+      }
+    }
+    std::string candidate(rounded, precision);
+    candidate += 'e';
+    formatInteger(rounded_exponent - precision + 1, candidate);
+    T parsed = T();
+    if (parseValue(candidate.data(), candidate.data() + candidate.size(), parsed) == conversion_error::none && parsed == value) {
+      std::memcpy(digits, rounded, precision);
+      count = precision;
+      exponent = rounded_exponent;
+      break;
+    }
+  }
+  while (count > 1 && digits[count - 1] == '0') {
+    count--;
+  }
+  appendFloatDigits(digits, count, exponent, max_digits, out);
+}
+
+// Appends a typed value as a field, escaped like writeCsvRow
+template <typename T, typename Dialect>
+inline typename std::enable_if<std::is_integral<T>::value>::type formatValue(T value, std::string& out, Dialect) {
+  formatInteger(value, out);
+}
+
+template <typename Dialect>
+inline void formatValue(bool value, std::string& out, Dialect) {
+  out += value ? "true" : "false";
+}
+
+template <typename Dialect>
+inline void formatValue(char value, std::string& out, Dialect) {
+  formatCsvField<Dialect>(&value, 1, out);
+}
+
+template <typename Dialect>
+inline void formatValue(float value, std::string& out, Dialect) {
+  formatFloat(value, out);
+}
+
+template <typename Dialect>
+inline void formatValue(double value, std::string& out, Dialect) {
+  formatFloat(value, out);
+}
+
+template <typename Dialect>
+inline void formatValue(long double value, std::string& out, Dialect) {
+  formatFloat(value, out);
+}
+
+template <typename Dialect>
+inline void formatValue(const char* value, std::string& out, Dialect) {
+  formatCsvField<Dialect>(value, std::strlen(value), out);
+}
+
+template <typename Dialect>
+inline void formatValue(const std::string& value, std::string& out, Dialect) {
+  formatCsvField<Dialect>(value.data(), value.size(), out);
+}
+
+template <typename Dialect>
+inline void formatValue(const view& value, std::string& out, Dialect) {
+  formatCsvField<Dialect>(value.data(), value.size(), out);
+}
+
+// Returns the indices of the projected columns. Names require a header, and indices are checked
+// against the header if there is one.
+inline std::vector<size_t> resolveProjection(const projection& columns, const std::vector<std::string>* header) {
+  std::vector<size_t> indices = columns.indices();
+  if (!columns.names().empty() && header == nullptr) {
+    throw std::runtime_error("Column names can only be projected with a header");
+  }
+  for (const std::string& name : columns.names()) {
+    indices.push_back(headerIndex(*header, name));
+  }
+  for (size_t index : indices) {
+    if (header != nullptr && index >= header->size()) {
+      throw std::out_of_range("Column " + std::to_string(index) + " out of bounds");
+    }
+  }
+  return indices;
+}
+
+inline bool matchesPredicate(const predicate& condition, const raw_field& field, std::string& scratch) {
+  const char* begin = field.begin;
+  const char* end = field.end;
+  if (field.escaped) {
+    unescapeCsvField(field, scratch);
+    begin = scratch.data();
+    end = begin + scratch.size();
+  }
+  size_t size = end - begin;
+  switch (condition.kind) {
+    case predicate::type::equals:
+      return size == condition.value.size() && std::memcmp(begin, condition.value.data(), size) == 0;
+    case predicate::type::starts_with:
+      return size >= condition.value.size() && std::memcmp(begin, condition.value.data(), condition.value.size()) == 0;
+    default:
+      double value;
+      if (parseValue(begin, end, value) != conversion_error::none) {
+        return false;
+      }
+      return (condition.min_inclusive ? value >= condition.min : value > condition.min) &&
+             (condition.max_inclusive ? value <= condition.max : value < condition.max);
+  }
+}
+
+// Reads the rows of a block_reader matching a filter, keeping only projected columns. Both are
+// optional, and column names are resolved against the header, which must already be read.
+class row_selector {
+ public:
+  row_selector(block_reader& reader, const std::vector<std::string>* header, const projection* columns, const filter* rows)
+    : reader_(reader), projected_(columns != nullptr), indices_(), header_(), min_columns_(header != nullptr ? header->size() : 0), predicates_(), fields_(), scratch_() {
+    if (columns != nullptr) {
+      indices_ = resolveProjection(*columns, header);
+      for (size_t index : indices_) {
+        if (header != nullptr) {
+          header_.push_back((*header)[index]);
+        }
+      }
+    } else if (header != nullptr) {
+      header_ = *header;
+    }
+    if (rows != nullptr) {
+      predicates_ = rows->predicates();
+      for (predicate& condition : predicates_) {
+        if (condition.by_name) {
+          if (header == nullptr) {
+            throw std::runtime_error("Column names can only be filtered with a header");
+          }
+          condition.index = headerIndex(*header, condition.name);
+        }
+      }
+    }
+  }
+
+  // Header of the selected columns, empty without header
+  inline const std::vector<std::string>& header() const { return header_; }
+
+  // Returns false at end of stream
+  bool readRow(std::vector<std::string>& row) {
+    while (reader_.readFields(fields_)) {
+      if (!matches()) {
+        continue;
+      }
+      if (projected_) {
+        copyFields(fields_, row, indices_);
+      } else {
+        copyFields(fields_, row, min_columns_);
+      }
+      return true;
+    }
+    return false;
+  }
+
+ private:
+  bool matches() {
+    for (const predicate& condition : predicates_) {
+      if (!matchesPredicate(condition, condition.index < fields_.size() ? fields_[condition.index] : missingField(), scratch_)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  block_reader& reader_;
+  bool projected_;
+  std::vector<size_t> indices_;
+  std::vector<std::string> header_;
+  size_t min_columns_;
+  std::vector<predicate> predicates_;
+  std::vector<raw_field> fields_;
+  std::string scratch_;
+};
+
+// Reads only the selected rows and columns, header is replaced by the projected header
+template <typename Table>
+inline void readStream(std::istream& in, Table& data, std::vector<std::string>* header, const projection* columns, const filter* rows) {
+  if (in.bad() || in.fail()) {
+    throw std::runtime_error("Bad input");
+  }
+  block_reader reader(in);
+  std::vector<std::string> full_header;
+  if (header != nullptr) {
+    reader.readRow(full_header);
+  }
+  row_selector selector(reader, header != nullptr ? &full_header : nullptr, columns, rows);
+  if (header != nullptr) {
+    *header = selector.header();
+  }
+  std::vector<std::string> row;
+  while (selector.readRow(row)) {
+    appendRow(data, row);
+  }
+}
+
+template <typename ParseFunc>
+inline void streamSelectedRows(std::istream& in, bool has_header, const projection* columns, const filter* rows, ParseFunc parse_func) {
+  if (in.bad() || in.fail()) {
+    throw std::runtime_error("Bad input");
+  }
+  block_reader reader(in);
+  std::vector<std::string> header;
+  if (has_header) {
+    reader.readRow(header);
+  }
+  row_selector selector(reader, has_header ? &header : nullptr, columns, rows);
+  header_map index(selector.header());
+  std::vector<std::string> row;
+  while (selector.readRow(row)) {
+    parse_func(selector.header(), index, row);
+  }
+}
+
+// Reads the rest of the stream into buffer
+inline void readAll(std::istream& in, std::string& buffer) {
+  const size_t block_size = 1 << 16;
+  size_t size = buffer.size();
+  // Reserve the remaining size of seekable streams, such as files
+  std::streampos begin = in.rdbuf()->pubseekoff(0, std::ios::cur, std::ios::in);
+  std::streampos end = in.rdbuf()->pubseekoff(0, std::ios::end, std::ios::in);
+  if (begin != std::streampos(-1) && end != std::streampos(-1)) {
+    in.rdbuf()->pubseekpos(begin, std::ios::in);
+    buffer.reserve(size + static_cast<size_t>(end - begin) + block_size);
+  }
+  while (true) {
+    buffer.resize(size + block_size);
+    size_t read = static_cast<size_t>(in.rdbuf()->sgetn(&buffer[size], block_size));
+    size += read;
+    if (read == 0) {
+      break;
+    }
+  }
+  buffer.resize(size);
+}
+
+// Reads the raw fields of one row from a tokenizer over a complete buffer
+inline void readRawRow(tokenizer& tokens, std::vector<raw_field>& row) {
+  bool new_row = false;
+  raw_field field;
+  while (!tokens.done() && !new_row) {
+    tokens.next(field, new_row);
+    row.push_back(field);
+  }
+}
+
+// Unescaped fields of the streamed row, reused between rows
+class lazy_cache {
+ public:
+  lazy_cache() : row_(0), values_(), rows_() {}
+
+  void nextRow(size_t columns) {
+    row_++;
+    if (values_.size() < columns) {
+      values_.resize(columns);
+      rows_.resize(columns, 0);
+    }
+  }
+
+  inline view decode(size_t column, const raw_field& field) {
+    if (!field.escaped) {
+      return view(field.begin, field.end - field.begin);
+    }
+    if (rows_[column] != row_) {
+      unescapeCsvField(field, values_[column]);
+      rows_[column] = row_;
+    }
+    return view(values_[column]);
+  }
+
+ private:
+  size_t row_;
+  std::vector<std::string> values_;
+  std::vector<size_t> rows_;  // row for which values_[i] was decoded
+};
+
+}  // namespace detail
+
+// Parses a field into result without throwing. Surrounding whitespace is ignored, but anything
+// else that is not part of the value is an error.
+template <typename T>
+inline conversion_error parse(const view& field, T& result) {
+  return detail::parseValue(field.begin(), field.end(), result);
+}
+
+// Buffered CSV writer for rows of strings or typed values. Fields without separators or quotes are
+// copied in bulk, and the output is written to the stream in large blocks. Rows are separated by
+// newlines, without a newline after the last row, like pH::csv::flat::write. The buffer is flushed
+// when the writer is destroyed.
+template <typename Dialect = csv_dialect>
+class basic_writer {
+ public:
+  explicit basic_writer(std::ostream& out, size_t buffer_size = 1 << 20) : out_(out), buffer_(), buffer_size_(buffer_size), rows_(0), in_row_(false) {
+    if (out.bad() || out.fail()) {
+      throw std::runtime_error("Bad output");
+    }
+    buffer_.reserve(buffer_size);
+  }
+
+  basic_writer(const basic_writer& other) = delete;
+  basic_writer& operator=(const basic_writer& other) = delete;
+
+  ~basic_writer() {
+    try {
+      flush();
+    } catch (...) {}
+  }
+
+  // Row is a container of std::strings or views
+  template <typename Row>
+  void writeRow(const Row& row) {
+    if (in_row_) {
+      endRow();
+    }
+    startRow();
+    detail::formatCsvRow<Dialect>(row, buffer_);
+    flushIfFull();
+  }
+
+  void writeRow(std::initializer_list<std::string> row) {
+    writeRow<std::initializer_list<std::string>>(row);
+  }
+
+  // Appends a field to the current row, starting a new row if needed. Integers, floating point
+  // numbers, bools, chars and strings are formatted straight into the buffer, floating point numbers
+  // with the fewest digits that parse back to the same value.
+  template <typename T>
+  basic_writer& writeField(const T& value) {
+    if (in_row_) {
+      buffer_ += Dialect::separator;
+    } else {
+      startRow();
+      in_row_ = true;
+    }
+    detail::formatValue(value, buffer_, Dialect());
+    return *this;
+  }
+
+  // Ends the current row. Without fields since the last row, writes an empty row.
+  void endRow() {
+    if (!in_row_) {
+      startRow();
+    }
+    in_row_ = false;
+    flushIfFull();
+  }
+
+  // Writes a row of typed values, as formatted by writeField
+  template <typename... Values>
+  void writeValues(const Values&... values) {
+    if (in_row_) {
+      endRow();
+    }
+    int expand[] = {0, (writeField(values), 0)...};
+    (void)expand;
+    endRow();
+  }
+
+  // Writes the buffered rows to the stream
+  void flush() {
+    out_.write(buffer_.data(), buffer_.size());
+    buffer_.clear();
+    if (out_.bad() || out_.fail()) {
+      throw std::runtime_error("Bad output");
+    }
+  }
+
+  inline size_t rows() const { return rows_; }
+
+ private:
+  void startRow() {
+    if (rows_++ > 0) {
+      buffer_ += Dialect::crlf ? "\r\n" : "\n";
+    }
+  }
+
+  void flushIfFull() {
+    if (buffer_.size() >= buffer_size_) {
+      flush();
+    }
+  }
+
+  std::ostream& out_;
+  std::string buffer_;
+  size_t buffer_size_;
+  size_t rows_;
+  bool in_row_;  // fields were written since the last row ended
+};
+
+typedef basic_writer<> writer;
+
+// Monotonic arena for the fields of pH::csv::arena_flat and pH::csv::arena_mapped. While a table is
+// read, fields are bump allocated from large blocks, which are all released at once when the table
+// is destroyed. After freeze(), allocations fall back to the heap, so fields that grow when they
+// are modified are freed normally.
+class field_arena {
+ public:
+  field_arena() : blocks_(), current_(nullptr), end_(nullptr), next_block_size_(1 << 16), frozen_(false), used_heap_(false) {}
+
+  field_arena(const field_arena& other) = delete;
+  field_arena& operator=(const field_arena& other) = delete;
+
+  ~field_arena() {
+    for (const auto& block : blocks_) {
+      ::operator delete(block.first);
+    }
+  }
+
+  void* allocate(size_t size, size_t alignment) {
+    if (frozen_) {
+      used_heap_ = true;
+      return ::operator new(size);
+    }
+    char* result = align(current_, alignment);
+    if (current_ == nullptr || size > static_cast<size_t>(end_ - result)) {
+      addBlock(size + alignment);
+      result = align(current_, alignment);
+    }
+    current_ = result + size;
+    return result;
+  }
+
+  void deallocate(void* pointer) {
+    // Arena memory is only released with the arena
+    if (used_heap_ && !owns(pointer)) {
+      ::operator delete(pointer);
+    }
+  }
+
+  inline void freeze() { frozen_ = true; }
+  inline bool frozen() const { return frozen_; }
+
+  // Bytes allocated for blocks
+  size_t capacity() const {
+    size_t result = 0;
+    for (const auto& block : blocks_) {
+      result += block.second;
+    }
+    return result;
+  }
+
+ private:
+  static inline char* align(char* pointer, size_t alignment) {
+    uintptr_t address = reinterpret_cast<uintptr_t>(pointer);
+    return reinterpret_cast<char*>((address + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1));
+  }
+
+  bool owns(const void* pointer) const {
+    const char* address = static_cast<const char*>(pointer);
+    auto it = std::upper_bound(blocks_.begin(), blocks_.end(), address, [] (const char* a, const std::pair<char*, size_t>& block) {
+      return std::less<const char*>()(a, block.first);
+    });
+    if (it == blocks_.begin()) {
+      return false;
+    }
+    --it;
+    return !std::less<const char*>()(address, it->first) && std::less<const char*>()(address, it->first + it->second);
+  }
+
+  void addBlock(size_t min_size) {
+    size_t size = std::max(next_block_size_, min_size);
+    next_block_size_ = std::min<size_t>(next_block_size_ * 2, 1 << 24);
+    char* block = static_cast<char*>(::operator new(size));
+    // Sorted by address for owns()
+    auto it = std::upper_bound(blocks_.begin(), blocks_.end(), block, [] (const char* a, const std::pair<char*, size_t>& other) {
+      return std::less<const char*>()(a, other.first);
+    });
+    blocks_.insert(it, std::make_pair(block, size));
+    current_ = block;
+    end_ = block + size;
+  }
+
+  std::vector<std::pair<char*, size_t>> blocks_;
+  char* current_;
+  char* end_;
+  size_t next_block_size_;
+  bool frozen_;
+  bool used_heap_;  // allocations after freeze() can't be told apart from arena memory otherwise
+};
+
+// Allocator drawing from a field_arena, or from the heap without one. Copies of fields and tables
+// use the heap, so they can outlive the arena, but fields moved out of a table must not.
+template <typename T>
+class arena_allocator {
+ public:
+  typedef T value_type;
+  typedef std::true_type propagate_on_container_move_assignment;
+  typedef std::true_type propagate_on_container_swap;
+
+  arena_allocator() noexcept : arena_(nullptr) {}
+  explicit arena_allocator(field_arena* arena) noexcept : arena_(arena) {}
+  template <typename U>
+  arena_allocator(const arena_allocator<U>& other) noexcept : arena_(other.arena()) {}
+
+  T* allocate(size_t n) {
+    if (arena_ == nullptr) {
+      return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T* pointer, size_t) {
+    if (arena_ == nullptr) {
+      ::operator delete(pointer);
+    } else {
+      arena_->deallocate(pointer);
+    }
+  }
+
+  arena_allocator select_on_container_copy_construction() const { return arena_allocator(); }
+
+  inline field_arena* arena() const noexcept { return arena_; }
+
+ private:
+  field_arena* arena_;
+};
+
+template <typename T, typename U>
+inline bool operator==(const arena_allocator<T>& a, const arena_allocator<U>& b) { return a.arena() == b.arena(); }
+
+template <typename T, typename U>
+inline bool operator!=(const arena_allocator<T>& a, const arena_allocator<U>& b) { return a.arena() != b.arena(); }
+
+namespace detail {
+
+// Tables using arena_allocator own an arena, other allocators are default constructed
+template <typename Allocator>
+struct table_storage {
+  static std::shared_ptr<field_arena> makeArena() { return nullptr; }
+  static Allocator allocator(field_arena*) { return Allocator(); }
+};
+
+template <typename T>
+struct table_storage<arena_allocator<T>> {
+  static std::shared_ptr<field_arena> makeArena() { return std::make_shared<field_arena>(); }
+  static arena_allocator<T> allocator(field_arena* arena) { return arena_allocator<T>(arena); }
+};
+
+template <typename Dialect = csv_dialect, typename Table>
+void writeStream(std::ostream& out, const Table& data, const std::vector<std::string>* header = nullptr) {
+  basic_writer<Dialect> csv(out);
+  if (header != nullptr) {
+    csv.writeRow(*header);
+    if (data.empty()) {
+      csv.writeRow(std::vector<std::string>());  // a header is always followed by a newline
+    }
+  }
+  for (const auto& row : data) {
+    csv.writeRow(row);
+  }
+  csv.flush();
+}
+
+}  // namespace detail
+
+// Table of strings, stored row by row. Allocator is used for the fields and rows, with
+// arena_allocator<char> all of them are drawn from an arena owned by the table, see
+// pH::csv::arena_flat.
+template <typename Allocator = std::allocator<char>>
+class basic_flat {
+ public:
+  typedef std::basic_string<char, std::char_traits<char>, Allocator> field_type;
+  typedef std::vector<field_type, typename std::allocator_traits<Allocator>::template rebind_alloc<field_type>> row_type;
+
+  basic_flat()
+    : arena_(detail::table_storage<Allocator>::makeArena()), data_(detail::table_storage<Allocator>::allocator(arena_.get())), columns_(0) {}
+
+  basic_flat(std::istream& in) : basic_flat() {
+    read(in);
+  }
+
+  basic_flat(const std::string& filename) : basic_flat() {
+    std::ifstream in(filename, std::ios::in | std::ios::binary);
+    read(in);
+  }
+
+  basic_flat(std::istream& in, const projection& columns) : basic_flat() {
+    columns_ = columns.indices().size();
+    readRows(in, nullptr, &columns, nullptr);
+  }
+
+  basic_flat(const std::string& filename, const projection& columns) : basic_flat() {
+    columns_ = columns.indices().size();
+    std::ifstream in(filename, std::ios::in | std::ios::binary);
+    readRows(in, nullptr, &columns, nullptr);
+  }
+
+  // Reads a file in another dialect, such as pH::csv::tsv_dialect()
+  template <char Separator, char Quote, bool Crlf>
+  basic_flat(std::istream& in, dialect<Separator, Quote, Crlf>) : basic_flat() {
+    read<dialect<Separator, Quote, Crlf>>(in);
+  }
+
+  template <char Separator, char Quote, bool Crlf>
+  basic_flat(const std::string& filename, dialect<Separator, Quote, Crlf>) : basic_flat() {
+    std::ifstream in(filename, std::ios::in | std::ios::binary);
+    read<dialect<Separator, Quote, Crlf>>(in);
+  }
+
+  virtual void write(std::ostream& out) const {
+    detail::writeStream(out, data_);
+  }
+
+  virtual void write(const std::string& filename) const {
+    std::ofstream out(filename, std::ios::out | std::ios::binary);
+    detail::writeStream(out, data_);
+  }
+
+  template <char Separator, char Quote, bool Crlf>
+  void write(std::ostream& out, dialect<Separator, Quote, Crlf>) const {
+    detail::writeStream<dialect<Separator, Quote, Crlf>>(out, data_);
+  }
+
+  template <char Separator, char Quote, bool Crlf>
+  void write(const std::string& filename, dialect<Separator, Quote, Crlf>) const {
+    std::ofstream out(filename, std::ios::out | std::ios::binary);
+    detail::writeStream<dialect<Separator, Quote, Crlf>>(out, data_);
+  }
+
+  inline size_t rows() const { return data_.size(); }
+  virtual inline size_t columns() const { return columns_; }
+  inline size_t columns(size_t row) const { return data_.at(row).size(); }
+
+  inline field_type& at(size_t row, size_t column) { return data_.at(row).at(column); }
+  inline const field_type& at(size_t row, size_t column) const { return data_.at(row).at(column); }
+
+  void emplaceRow(size_t columns) { data_.emplace_back(columns); }
+  virtual void emplaceRow() { data_.emplace_back(columns_); }
+
+  virtual void resizeColumns(size_t size) {
+    columns_ = size;
+    for (auto& row : data_) {
+      row.resize(size);
+    }
+  }
+
+  template <typename T = std::string>
+  inline T get(size_t row, size_t column) const {
+    return detail::convert<T>(data_.at(row).at(column));
+  }
+
+  // Empty fields are converted to empty_value instead of throwing
+  template <typename T>
+  inline T get(size_t row, size_t column, const T& empty_value) const {
+    return detail::convert<T>(data_.at(row).at(column), empty_value);
+  }
+
+  // Converts a whole column in one pass
+  template <typename T = std::string>
+  std::vector<T> getColumn(size_t column) const {
+    std::vector<T> result;
+    result.reserve(data_.size());
+    for (const auto& row : data_) {
+      result.push_back(detail::convert<T>(row.at(column)));
+    }
+    return result;
+  }
+
+  template <typename T>
+  std::vector<T> getColumn(size_t column, const T& empty_value) const {
+    std::vector<T> result;
+    result.reserve(data_.size());
+    for (const auto& row : data_) {
+      result.push_back(detail::convert<T>(row.at(column), empty_value));
+    }
+    return result;
+  }
+
+  bool operator==(const basic_flat& other) const { return data_ == other.data_; }
+  bool operator!=(const basic_flat& other) const { return !(*this == other); }
+
+  virtual ~basic_flat() = default;
+
+ protected:
+  // Fields read after this are allocated on the heap, so they are freed when they change
+  void readRows(std::istream& in, std::vector<std::string>* header, const projection* columns, const filter* rows) {
+    detail::readStream(in, data_, header, columns, rows);
+    freeze();
+  }
+
+  template <typename Dialect = csv_dialect>
+  void readRows(std::istream& in, std::vector<std::string>* header) {
+    detail::readStream<Dialect>(in, data_, header);
+    freeze();
+  }
+
+  inline void freeze() {
+    if (arena_) {
+      arena_->freeze();
+    }
+  }
+
+  std::shared_ptr<field_arena> arena_;  // null unless Allocator is an arena_allocator
+  std::vector<row_type, typename std::allocator_traits<Allocator>::template rebind_alloc<row_type>> data_;
+
+ private:
+  template <typename Dialect = csv_dialect>
+  void read(std::istream& in) {
+    readRows<Dialect>(in, nullptr);
+    for (const auto& row : data_) {
+      columns_ = std::max(columns_, row.size());
+    }
+  }
+
+  size_t columns_;
+};
+
+typedef basic_flat<> flat;
+
+// pH::csv::flat drawing its fields from an arena while reading, which makes reading faster and
+// destroying large tables much faster. Fields are pH::csv::arena_flat::field_type instead of
+// std::string, and grow on the heap when they are modified.
+typedef basic_flat<arena_allocator<char>> arena_flat;
+
+class mapped_row {
+ public:
+  mapped_row(const std::vector<std::string>& header, const std::vector<std::string>& data) : header_(header), index_(nullptr), data_(data) {}
+  mapped_row(const std::vector<std::string>& header, const detail::header_map& index, const std::vector<std::string>& data)
+    : header_(header), index_(&index), data_(data) {}
+  mapped_row() = delete;
+  mapped_row(const mapped_row& other) = delete;
+  mapped_row(mapped_row&& other) = delete;
+  mapped_row& operator=(const mapped_row& other) = delete;
+  mapped_row& operator=(mapped_row&& other) = delete;
+
+  inline size_t size() const { return data_.size(); }
+
+  // Resolve a column once, for example in the first row, to skip the lookup in later rows
+  inline column_handle column(const std::string& column) const { return column_handle(headerIndex(column)); }
+
+  inline const std::string& at(const std::string& column) const {
+    return data_[headerIndex(column)];
   }
 
   inline const std::string& at(size_t column) const {
     if (column >= data_.size()) {
       throw std::runtime_error("Column " + std::to_string(column) + " out of bounds");
     }
-    return data_[column];
+    return data_[column];
+  }
+
+  inline const std::string& at(column_handle column) const { return at(column.index()); }
+
+  template <typename T = std::string>
+  inline T get(const std::string& column) const { return detail::convert<T>(at(column)); }
+  template <typename T = std::string>
+  inline T get(size_t column) const { return detail::convert<T>(at(column)); }
+  template <typename T>
+  inline T get(const std::string& column, const T& empty_value) const { return detail::convert<T>(at(column), empty_value); }
+  template <typename T>
+  inline T get(size_t column, const T& empty_value) const { return detail::convert<T>(at(column), empty_value); }
+  template <typename T = std::string>
+  inline T get(column_handle column) const { return detail::convert<T>(at(column)); }
+  template <typename T>
+  inline T get(column_handle column, const T& empty_value) const { return detail::convert<T>(at(column), empty_value); }
+
+ private:
+  inline size_t headerIndex(const std::string& column) const {
+    return index_ != nullptr ? index_->at(column) : detail::headerIndex(header_, column);
+  }
+
+  const std::vector<std::string>& header_;
+  const detail::header_map* index_;  // linear search in header_ if null
+  const std::vector<std::string>& data_;
+};
+
+// pH::csv::basic_flat for files with a header
+template <typename Allocator = std::allocator<char>>
+class basic_mapped : public basic_flat<Allocator> {
+ public:
+  typedef typename basic_flat<Allocator>::field_type field_type;
+
+  basic_mapped(std::istream& in) : basic_flat<Allocator>(), header_(), index_() {
+    this->readRows(in, &header_);
+    index_.assign(header_);
+  }
+
+  basic_mapped(const std::string& filename) : basic_flat<Allocator>(), header_(), index_() {
+    std::ifstream in(filename, std::ios::in | std::ios::binary);
+    this->readRows(in, &header_);
+    index_.assign(header_);
+  }
+
+  // Only keeps the projected columns, in the given order
+  basic_mapped(std::istream& in, const projection& columns) : basic_flat<Allocator>(), header_(), index_() {
+    this->readRows(in, &header_, &columns, nullptr);
+    index_.assign(header_);
+  }
+
+  basic_mapped(const std::string& filename, const projection& columns) : basic_flat<Allocator>(), header_(), index_() {
+    std::ifstream in(filename, std::ios::in | std::ios::binary);
+    this->readRows(in, &header_, &columns, nullptr);
+    index_.assign(header_);
+  }
+
+  // Only keeps the rows matching the filter
+  basic_mapped(std::istream& in, const filter& rows) : basic_flat<Allocator>(), header_(), index_() {
+    this->readRows(in, &header_, nullptr, &rows);
+    index_.assign(header_);
+  }
+
+  basic_mapped(const std::string& filename, const filter& rows) : basic_flat<Allocator>(), header_(), index_() {
+    std::ifstream in(filename, std::ios::in | std::ios::binary);
+    this->readRows(in, &header_, nullptr, &rows);
+    index_.assign(header_);
+  }
+
+  basic_mapped(std::istream& in, const projection& columns, const filter& rows) : basic_flat<Allocator>(), header_(), index_() {
+    this->readRows(in, &header_, &columns, &rows);
+    index_.assign(header_);
+  }
+
+  basic_mapped(const std::string& filename, const projection& columns, const filter& rows) : basic_flat<Allocator>(), header_(), index_() {
+    std::ifstream in(filename, std::ios::in | std::ios::binary);
+    this->readRows(in, &header_, &columns, &rows);
+    index_.assign(header_);
+  }
+
+  // Reads a file in another dialect, such as pH::csv::tsv_dialect()
+  template <char Separator, char Quote, bool Crlf>
+  basic_mapped(std::istream& in, dialect<Separator, Quote, Crlf>) : basic_flat<Allocator>(), header_(), index_() {
+    this->template readRows<dialect<Separator, Quote, Crlf>>(in, &header_);
+    index_.assign(header_);
+  }
+
+  template <char Separator, char Quote, bool Crlf>
+  basic_mapped(const std::string& filename, dialect<Separator, Quote, Crlf>) : basic_flat<Allocator>(), header_(), index_() {
+    std::ifstream in(filename, std::ios::in | std::ios::binary);
+    this->template readRows<dialect<Separator, Quote, Crlf>>(in, &header_);
+    index_.assign(header_);
+  }
+
+  basic_mapped(std::vector<std::string> header, basic_flat<Allocator> data = basic_flat<Allocator>()) : basic_flat<Allocator>(std::move(data)), header_(std::move(header)), index_(header_) {}
+
+  void write(std::ostream& out) const override {
+    detail::writeStream(out, this->data_, &header_);
+  }
+
+  void write(const std::string& filename) const override {
+    std::ofstream out(filename, std::ios::out | std::ios::binary);
+    detail::writeStream(out, this->data_, &header_);
+  }
+
+  void write(std::ostream& out, bool skip_header) const {
+    detail::writeStream(out, this->data_, skip_header ? nullptr : &header_);
+  }
+
+  void write(const std::string& filename, bool skip_header) const {
+    std::ofstream out(filename, std::ios::out | std::ios::binary);
+    detail::writeStream(out, this->data_, skip_header ? nullptr : &header_);
+  }
+
+  template <char Separator, char Quote, bool Crlf>
+  void write(std::ostream& out, dialect<Separator, Quote, Crlf>, bool skip_header = false) const {
+    detail::writeStream<dialect<Separator, Quote, Crlf>>(out, this->data_, skip_header ? nullptr : &header_);
+  }
+
+  template <char Separator, char Quote, bool Crlf>
+  void write(const std::string& filename, dialect<Separator, Quote, Crlf>, bool skip_header = false) const {
+    std::ofstream out(filename, std::ios::out | std::ios::binary);
+    detail::writeStream<dialect<Separator, Quote, Crlf>>(out, this->data_, skip_header ? nullptr : &header_);
+  }
+
+  inline const std::vector<std::string>& header() const { return header_; }
+
+  inline size_t headerIndex(const std::string& column) const {
+      return index_.at(column);
+  }
+
+  // Resolve a column once to access it in many rows without looking up the name
+  inline column_handle column(const std::string& column) const { return column_handle(headerIndex(column)); }
+
+  using basic_flat<Allocator>::at;
+  inline field_type& at(size_t row, const std::string& column) { return this->data_.at(row).at(headerIndex(column)); }
+  inline const field_type& at(size_t row, const std::string& column) const { return this->data_.at(row).at(headerIndex(column)); }
+  inline field_type& at(size_t row, column_handle column) { return this->data_.at(row).at(column.index()); }
+  inline const field_type& at(size_t row, column_handle column) const { return this->data_.at(row).at(column.index()); }
+
+  void emplaceRow() override { this->data_.emplace_back(header_.size(), ""); }
+
+  void resizeColumns(size_t size) override {
+    if (size > header_.size()) {
+      throw std::runtime_error("Can not increase number of headers with pH::csv::mapped::resizeColumns");
+    }
+    header_.resize(size);
+    index_.assign(header_);
+    basic_flat<Allocator>::resizeColumns(size);
+  }
+
+  inline size_t columns() const override { return header_.size(); }
+
+  inline void emplaceColumn(const std::string& column) {
+    if (std::find(header_.begin(), header_.end(), column) == header_.end()) {
+      header_.push_back(column);
+      index_.assign(header_);
+      for (auto& row : this->data_) {
+        row.emplace_back();
+      }
+    }
+  }
+
+  using basic_flat<Allocator>::get;
+  template <typename T = std::string>
+  inline T get(size_t row, const std::string& column) const { return basic_flat<Allocator>::template get<T>(row, headerIndex(column)); }
+  template <typename T>
+  inline T get(size_t row, const std::string& column, const T& empty_value) const { return basic_flat<Allocator>::template get<T>(row, headerIndex(column), empty_value); }
+  template <typename T = std::string>
+  inline T get(size_t row, column_handle column) const { return basic_flat<Allocator>::template get<T>(row, column.index()); }
+  template <typename T>
+  inline T get(size_t row, column_handle column, const T& empty_value) const { return basic_flat<Allocator>::template get<T>(row, column.index(), empty_value); }
+
+  using basic_flat<Allocator>::getColumn;
+  template <typename T = std::string>
+  inline std::vector<T> getColumn(const std::string& column) const { return basic_flat<Allocator>::template getColumn<T>(headerIndex(column)); }
+  template <typename T>
+  inline std::vector<T> getColumn(const std::string& column, const T& empty_value) const { return basic_flat<Allocator>::template getColumn<T>(headerIndex(column), empty_value); }
+
+  bool operator==(const basic_mapped& other) const { return header_ == other.header_ && basic_flat<Allocator>::operator==(other); }
+  bool operator!=(const basic_mapped& other) const { return !(*this == other); }
+
+ private:
+  std::vector<std::string> header_;
+  detail::header_map index_;
+};
+
+typedef basic_mapped<> mapped;
+
+// pH::csv::mapped drawing its fields from an arena, see pH::csv::arena_flat
+typedef basic_mapped<arena_allocator<char>> arena_mapped;
+
+// Read only alternative to pH::csv::flat that stores each column in one contiguous buffer with
+// offsets to the fields, instead of one std::string per field. Rows with fewer fields than
+// columns() are padded with empty fields.
+class columnar {
+ public:
+  columnar() : data_(), rows_(0) {}
+
+  columnar(std::istream& in) : columnar() {
+    read(in, nullptr);
+  }
+
+  columnar(const std::string& filename) : columnar() {
+    std::ifstream in(filename, std::ios::in | std::ios::binary);
+    read(in, nullptr);
+  }
+
+  inline size_t rows() const { return rows_; }
+  virtual inline size_t columns() const { return data_.size(); }
+
+  inline view at(size_t row, size_t column) const {
+    const column_data& data = data_.at(column);
+    if (row >= rows_) {
+      throw std::out_of_range("Row " + std::to_string(row) + " out of bounds");
+    }
+    return view(data.chars.data() + data.offsets[row], data.offsets[row + 1] - data.offsets[row]);
+  }
+
+  template <typename T = std::string>
+  inline T get(size_t row, size_t column) const {
+    return detail::convert<T>(at(row, column));
+  }
+
+  template <typename T>
+  inline T get(size_t row, size_t column, const T& empty_value) const {
+    return detail::convert<T>(at(row, column), empty_value);
+  }
+
+  // Converts a whole column in one pass over its buffer
+  template <typename T = std::string>
+  std::vector<T> getColumn(size_t column) const {
+    std::vector<T> result;
+    result.reserve(rows_);
+    for (size_t row = 0; row < rows_; row++) {
+      result.push_back(detail::convert<T>(at(row, column)));
+    }
+    return result;
+  }
+
+  template <typename T>
+  std::vector<T> getColumn(size_t column, const T& empty_value) const {
+    std::vector<T> result;
+    result.reserve(rows_);
+    for (size_t row = 0; row < rows_; row++) {
+      result.push_back(detail::convert<T>(at(row, column), empty_value));
+    }
+    return result;
+  }
+
+  virtual ~columnar() = default;
+
+ protected:
+  struct column_data {
+    std::string chars;
+    std::vector<size_t> offsets;  // field i is chars[offsets[i], offsets[i + 1])
+  };
+
+  void read(std::istream& in, std::vector<std::string>* header) {
+    if (in.bad() || in.fail()) {
+      throw std::runtime_error("Bad input");
+    }
+    detail::block_reader reader(in);
+    if (header != nullptr && reader.readRow(*header)) {
+      addColumns(header->size());
+    }
+    std::vector<detail::raw_field> fields;
+    while (reader.readFields(fields)) {
+      addColumns(fields.size());
+      for (size_t i = 0; i < fields.size(); i++) {
+        detail::appendCsvField(fields[i], data_[i].chars);
+      }
+      for (auto& data : data_) {
+        data.offsets.push_back(data.chars.size());
+      }
+      rows_++;
+    }
+  }
+
+  std::vector<column_data> data_;
+  size_t rows_;
+
+ private:
+  void addColumns(size_t columns) {
+    while (data_.size() < columns) {
+      data_.emplace_back();
+      data_.back().offsets.assign(rows_ + 1, 0);
+    }
+  }
+};
+
+// Read only alternative to pH::csv::mapped with the column oriented storage of pH::csv::columnar
+class mapped_columnar : public columnar {
+ public:
+  mapped_columnar(std::istream& in) : columnar(), header_(), index_() {
+    read(in, &header_);
+    index_.assign(header_);
+  }
+
+  mapped_columnar(const std::string& filename) : columnar(), header_(), index_() {
+    std::ifstream in(filename, std::ios::in | std::ios::binary);
+    read(in, &header_);
+    index_.assign(header_);
+  }
+
+  inline const std::vector<std::string>& header() const { return header_; }
+
+  inline size_t headerIndex(const std::string& column) const {
+    return index_.at(column);
+  }
+
+  using columnar::at;
+  inline view at(size_t row, const std::string& column) const { return at(row, headerIndex(column)); }
+
+  using columnar::get;
+  template <typename T = std::string>
+  inline T get(size_t row, const std::string& column) const { return columnar::get<T>(row, headerIndex(column)); }
+  template <typename T>
+  inline T get(size_t row, const std::string& column, const T& empty_value) const { return columnar::get<T>(row, headerIndex(column), empty_value); }
+
+  using columnar::getColumn;
+  template <typename T = std::string>
+  inline std::vector<T> getColumn(const std::string& column) const { return columnar::getColumn<T>(headerIndex(column)); }
+  template <typename T>
+  inline std::vector<T> getColumn(const std::string& column, const T& empty_value) const { return columnar::getColumn<T>(headerIndex(column), empty_value); }
+
+  inline size_t columns() const override { return header_.size(); }
+
+ private:
+  std::vector<std::string> header_;
+  detail::header_map index_;
+};
+
+enum class column_type {
+  string,
+  int64,
+  float64,
+  boolean,
+  dictionary  // strings stored as codes into a table of distinct values
+};
+
+namespace detail {
+
+// Converts a stored integer to T, with the range checks of parseInteger
+template <typename T>
+inline typename std::enable_if<std::is_signed<T>::value, bool>::type castInteger(int64_t value, T& result) {
+  if (value < static_cast<int64_t>(std::numeric_limits<T>::min()) || value > static_cast<int64_t>(std::numeric_limits<T>::max())) {
+    return false;
+  }
+  result = static_cast<T>(value);
+  return true;
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_unsigned<T>::value, bool>::type castInteger(int64_t value, T& result) {
+  if (value < 0 || static_cast<uint64_t>(value) > static_cast<uint64_t>(std::numeric_limits<T>::max())) {
+    return false;
+  }
+  result = static_cast<T>(value);
+  return true;
+}
+
+inline bool sameText(const std::string& text, const char* begin, const char* end) {
+  return text.size() == static_cast<size_t>(end - begin) && std::memcmp(text.data(), begin, text.size()) == 0;
+}
+
+// True if value, parsed from the text [begin, end), is formatted back to the same text
+template <typename T>
+inline bool formatsAs(T value, const char* begin, const char* end, std::string& scratch) {
+  scratch.clear();
+  formatValue(value, scratch, csv_dialect());
+  return sameText(scratch, begin, end);
+}
+
+// As above without printing the value for normal numbers with at most digits10 significant digits,
+// which are always formatted back to the same digits, so only the layout of the text is checked
+// against formatFloat. Other numbers with more digits return false, as if they were formatted
+// differently.
+inline bool formatsAs(double value, const char* begin, const char* end, std::string& scratch) {
+  if (!std::isnormal(value)) {
+    scratch.clear();
+    formatFloat(value, scratch);
+    return sameText(scratch, begin, end);
+  }
+  const char* first = begin + (*begin == '-' ? 1 : 0);
+  const char* pos = first;
+  int count = 0;  // significant digits, without trailing zeros
+  int zeros = 0;  // zeros after the last nonzero digit
+  int before_point = 0;  // significant digits before the decimal point
+  int leading_zeros = 0;  // zeros after the decimal point before the first significant digit
+  const char* point = nullptr;
+  for (; pos != end; pos++) {
+    if (*pos == '.' && point == nullptr) {
+      point = pos;
+    } else if (!isDigit(*pos)) {
+      break;
+    } else if (count == 0 && *pos == '0') {
+      leading_zeros += point != nullptr ? 1 : 0;
+    } else {
+      before_point += point != nullptr ? 0 : 1;
+      if (*pos == '0') {
+        zeros++;
+      } else {
+        count += zeros + 1;
+        zeros = 0;
+      }
+    }
+  }
+  if (count > std::numeric_limits<double>::digits10) {
+    return false;
+  }
+  int exponent = before_point > 0 ? before_point - 1 : -leading_zeros - 1;
+  const int max_digits = std::numeric_limits<double>::max_digits10;
+  if (pos != end) {
+    // Scientific notation, like "1.5e+20" or "2e-07"
+    const char* digits = pos + 2;
+    if (end - pos < 4 || pos[0] != 'e' || (pos[1] != '+' && pos[1] != '-') || (end - digits > 2 && *digits == '0')) {
+      return false;
+    }
+    int shift = 0;
+    for (const char* digit = digits; digit != end; digit++) {
+      if (!isDigit(*digit) || shift > 1000) {
+        return false;
+      }
+      shift = shift * 10 + (*digit - '0');
+    }
+    exponent += pos[1] == '-' ? -shift : shift;
+    return before_point == 1 && *first != '0' && (pos[1] == '-') == (exponent < 0) && (exponent < -4 || exponent >= max_digits - 1) &&
+           (count == 1 ? point == nullptr : point == first + 1 && zeros == 0);
+  }
+  if (exponent < -4 || exponent >= max_digits - 1) {
+    return false;
+  }
+  if (exponent < 0) {
+    return point == first + 1 && *first == '0' && zeros == 0;  // "0.05"
+  }
+  if (count <= exponent + 1) {
+    return point == nullptr && *first != '0';  // "1500"
+  }
+  return point != nullptr && *first != '0' && zeros == 0;  // "1.5"
+}
+
+// Infers the type of a column from a sample of fields. Empty fields are ignored, and columns
+// without values are strings.
+inline column_type inferType(const std::vector<std::vector<std::string>>& sample, size_t column) {
+  bool integers = true;
+  bool reals = true;
+  bool booleans = true;
+  bool any = false;
+  for (const auto& row : sample) {
+    if (column >= row.size() || row[column].empty()) {
+      continue;
+    }
+    const char* begin = row[column].data();
+    const char* end = begin + row[column].size();
+    int64_t integer;
+    double real;
+    bool boolean;
+    any = true;
+    integers = integers && parseValue(begin, end, integer) == conversion_error::none;
+    reals = reals && parseValue(begin, end, real) == conversion_error::none;
+    booleans = booleans && parseValue(begin, end, boolean) == conversion_error::none;
+  }
+  if (!any) {
+    return column_type::string;
+  }
+  if (integers) {
+    return column_type::int64;
+  }
+  if (booleans) {
+    return column_type::boolean;
+  }
+  return reals ? column_type::float64 : column_type::string;
+}
+
+// Counts the distinct values of a column in a sample, up to limit. Rows without the column are
+// skipped, so a sample with no values for the column counts 0.
+inline size_t countDistinct(const std::vector<std::vector<std::string>>& sample, size_t column, size_t limit) {
+  std::unordered_set<std::string> values;
+  for (const auto& row : sample) {
+    if (values.size() >= limit) {
+      break;
+    }
+    if (column < row.size()) {
+      values.insert(row[column]);
+    }
+  }
+  return values.size();
+}
+
+}  // namespace detail
+
+// Read only column oriented table where the type of each column is inferred from the first
+// sample_rows rows. int64, double and bool columns are stored as arrays of values, so get<T> with
+// the stored type, or a wider one, is an array load. Fields that don't match the type of their
+// column, including empty fields, are kept as strings. The text of values that would be formatted
+// differently, like "3000.00" or "007", is kept next to the value, so str returns every field as
+// it was in the input.
+// String columns with at most dictionary_size distinct values in the sample are dictionary encoded:
+// each distinct value is stored once and each row stores its code, so filtering and grouping rows
+// by value compares integers. A dictionary_size of 0, or a sample without values for the column,
+// keeps the column as strings.
+class typed_columnar {
+ public:
+  typed_columnar() : data_(), rows_(0), scratch_() {}
+
+  explicit typed_columnar(std::istream& in, size_t sample_rows = 1 << 10, size_t dictionary_size = 0) : typed_columnar() {
+    read(in, nullptr, sample_rows, dictionary_size);
+  }
+
+  explicit typed_columnar(const std::string& filename, size_t sample_rows = 1 << 10, size_t dictionary_size = 0) : typed_columnar() {
+    std::ifstream in(filename, std::ios::in | std::ios::binary);
+    read(in, nullptr, sample_rows, dictionary_size);
+  }
+
+  inline size_t rows() const { return rows_; }
+  virtual inline size_t columns() const { return data_.size(); }
+
+  inline column_type type(size_t column) const { return data_.at(column).type; }
+
+  // True if the field is stored as a value of the column's type
+  inline bool native(size_t row, size_t column) const {
+    const column_data& data = checkedColumn(row, column);
+    return !isText(data.type) && (data.fallback.empty() || !data.fallback[row]);
+  }
+
+  // The values of int64 and bool columns, 0 for fields that are not native
+  inline const std::vector<int64_t>& integers(size_t column) const {
+    const column_data& data = data_.at(column);
+    if (data.type != column_type::int64 && data.type != column_type::boolean) {
+      throw std::runtime_error("Column " + std::to_string(column) + " is not an int64 or bool column");
+    }
+    return data.integers;
+  }
+
+  // The values of double columns, 0 for fields that are not native
+  inline const std::vector<double>& reals(size_t column) const {
+    const column_data& data = data_.at(column);
+    if (data.type != column_type::float64) {
+      throw std::runtime_error("Column " + std::to_string(column) + " is not a double column");
+    }
+    return data.reals;
+  }
+
+  // The code of each row of a dictionary column, an index into dictionary(column)
+  inline const std::vector<uint32_t>& codes(size_t column) const {
+    return dictionaryColumn(column).codes;
+  }
+
+  // The distinct values of a dictionary column, in order of appearance
+  inline const std::vector<std::string>& dictionary(size_t column) const {
+    return dictionaryColumn(column).dictionary;
+  }
+
+  // The code of value in a dictionary column, or dictionary(column).size() if it doesn't appear
+  inline uint32_t code(size_t column, const std::string& value) const {
+    const column_data& data = dictionaryColumn(column);
+    auto it = data.dictionary_index.find(value);
+    return it == data.dictionary_index.end() ? static_cast<uint32_t>(data.dictionary.size()) : it->second;
+  }
+
+  // The rows of a dictionary column equal to value
+  std::vector<size_t> findRows(size_t column, const std::string& value) const {
+    const std::vector<uint32_t>& column_codes = codes(column);
+    uint32_t value_code = code(column, value);
+    std::vector<size_t> result;
+    for (size_t row = 0; row < column_codes.size(); row++) {
+      if (column_codes[row] == value_code) {
+        result.push_back(row);
+      }
+    }
+    return result;
+  }
+
+  // The rows of a dictionary column grouped by value, the rows of dictionary(column)[i] are result[i]
+  std::vector<std::vector<size_t>> groupRows(size_t column) const {
+    const column_data& data = dictionaryColumn(column);
+    std::vector<size_t> counts(data.dictionary.size(), 0);
+    for (uint32_t value_code : data.codes) {
+      counts[value_code]++;
+    }
+    std::vector<std::vector<size_t>> result(data.dictionary.size());
+    for (size_t i = 0; i < result.size(); i++) {
+      result[i].reserve(counts[i]);
+    }
+    for (size_t row = 0; row < data.codes.size(); row++) {
+      result[data.codes[row]].push_back(row);
+    }
+    return result;
+  }
+
+  // The field as a string, as it was in the input
+  std::string str(size_t row, size_t column) const {
+    const column_data& data = checkedColumn(row, column);
+    if (isText(data.type)) {
+      return textView(data, row).str();
+    }
+    if (!data.fallback.empty() && data.fallback[row]) {
+      return fallbackValue(data, row);
+    }
+    auto text = std::lower_bound(data.text_rows.begin(), data.text_rows.end(), row);
+    if (text != data.text_rows.end() && *text == row) {
+      size_t i = text - data.text_rows.begin();
+      size_t begin = i == 0 ? 0 : data.text_ends[i - 1];
+      return data.text_chars.substr(begin, data.text_ends[i] - begin);
+    }
+    std::string result;
+    switch (data.type) {
+      case column_type::int64:
+        detail::formatInteger(data.integers[row], result);
+        break;
+      case column_type::boolean:
+        result = data.integers[row] != 0 ? "true" : "false";
+        break;
+      default:
+        detail::formatFloat(data.reals[row], result);
+        break;
+    }
+    return result;
+  }
+
+  template <typename T = std::string>
+  inline T get(size_t row, size_t column) const {
+    T result;
+    if (getNative(row, column, result)) {
+      return result;
+    }
+    return getText<T>(row, column);
+  }
+
+  template <typename T>
+  inline T get(size_t row, size_t column, const T& empty_value) const {
+    T result;
+    if (getNative(row, column, result)) {
+      return result;
+    }
+    return getText<T>(row, column, empty_value);
+  }
+
+  template <typename T = std::string>
+  std::vector<T> getColumn(size_t column) const {
+    std::vector<T> result;
+    result.reserve(rows_);
+    for (size_t row = 0; row < rows_; row++) {
+      result.push_back(get<T>(row, column));
+    }
+    return result;
+  }
+
+  template <typename T>
+  std::vector<T> getColumn(size_t column, const T& empty_value) const {
+    std::vector<T> result;
+    result.reserve(rows_);
+    for (size_t row = 0; row < rows_; row++) {
+      result.push_back(get<T>(row, column, empty_value));
+    }
+    return result;
+  }
+
+  virtual ~typed_columnar() = default;
+
+ protected:
+  struct column_data {
+    column_type type;
+    std::vector<int64_t> integers;  // int64 and bool columns
+    std::vector<double> reals;  // double columns
+    std::string chars;  // string columns, field i is chars[offsets[i], offsets[i + 1])
+    std::vector<size_t> offsets;
+    std::vector<bool> fallback;  // rows kept as strings in typed columns, empty if there are none
+    std::vector<size_t> fallback_rows;
+    std::vector<std::string> fallback_values;
+    std::vector<size_t> text_rows;  // native rows with text that isn't formatted back the same
+    std::string text_chars;  // text i is text_chars[text_ends[i - 1], text_ends[i])
+    std::vector<size_t> text_ends;
+    std::vector<uint32_t> codes;  // dictionary columns
+    std::vector<std::string> dictionary;
+    std::unordered_map<std::string, uint32_t> dictionary_index;
+  };
+
+  void read(std::istream& in, std::vector<std::string>* header, size_t sample_rows, size_t dictionary_size) {
+    if (in.bad() || in.fail()) {
+      throw std::runtime_error("Bad input");
+    }
+    detail::block_reader reader(in);
+    size_t columns = 0;
+    if (header != nullptr && reader.readRow(*header)) {
+      columns = header->size();
+    }
+    std::vector<std::vector<std::string>> sample;
+    std::vector<std::string> row;
+    while (sample.size() < sample_rows && reader.readRow(row)) {
+      columns = std::max(columns, row.size());
+      sample.push_back(row);
+    }
+    for (size_t column = 0; column < columns; column++) {
+      column_type type = detail::inferType(sample, column);
+      if (type == column_type::string && dictionary_size > 0) {
+        size_t distinct = detail::countDistinct(sample, column, dictionary_size + 1);
+        if (distinct > 0 && distinct <= dictionary_size) {
+          type = column_type::dictionary;
+        }
+      }
+      addColumn(type);
+    }
+    for (const auto& sample_row : sample) {
+      for (size_t column = 0; column < columns; column++) {
+        const std::string& field = column < sample_row.size() ? sample_row[column] : std::string();
+        append(data_[column], field.data(), field.data() + field.size());
+      }
+      rows_++;
+    }
+    std::vector<detail::raw_field> fields;
+    std::string scratch;
+    while (reader.readFields(fields)) {
+      while (data_.size() < fields.size()) {
+        addColumn(column_type::string);
+      }
+      for (size_t column = 0; column < data_.size(); column++) {
+        if (column >= fields.size()) {
+          append(data_[column], nullptr, nullptr);
+        } else if (fields[column].escaped) {
+          detail::unescapeCsvField(fields[column], scratch);
+          append(data_[column], scratch.data(), scratch.data() + scratch.size());
+        } else {
+          append(data_[column], fields[column].begin, fields[column].end);
+        }
+      }
+      rows_++;
+    }
+  }
+
+  std::vector<column_data> data_;
+  size_t rows_;
+
+ private:
+  const column_data& checkedColumn(size_t row, size_t column) const {
+    const column_data& data = data_.at(column);
+    if (row >= rows_) {
+      throw std::out_of_range("Row " + std::to_string(row) + " out of bounds");
+    }
+    return data;
+  }
+
+  const column_data& dictionaryColumn(size_t column) const {
+    const column_data& data = data_.at(column);
+    if (data.type != column_type::dictionary) {
+      throw std::runtime_error("Column " + std::to_string(column) + " is not a dictionary column");
+    }
+    return data;
+  }
+
+  static inline bool isText(column_type type) {
+    return type == column_type::string || type == column_type::dictionary;
+  }
+
+  static inline view textView(const column_data& data, size_t row) {
+    if (data.type == column_type::dictionary) {
+      const std::string& value = data.dictionary[data.codes[row]];
+      return view(value.data(), value.size());
+    }
+    return view(data.chars.data() + data.offsets[row], data.offsets[row + 1] - data.offsets[row]);
+  }
+
+  void addColumn(column_type type) {
+    data_.emplace_back();
+    column_data& data = data_.back();
+    data.type = type;
+    // Rows before a column appeared are empty
+    switch (type) {
+      case column_type::string:
+        data.offsets.assign(rows_ + 1, 0);
+        return;
+      case column_type::dictionary:
+        for (size_t row = 0; row < rows_; row++) {
+          append(data, nullptr, nullptr);
+        }
+        return;
+      case column_type::float64:
+        data.reals.assign(rows_, 0);
+        break;
+      default:
+        data.integers.assign(rows_, 0);
+        break;
+    }
+    for (size_t row = 0; row < rows_; row++) {
+      addFallback(data, row, std::string());
+    }
+  }
+
+  void append(column_data& data, const char* begin, const char* end) {
+    bool native = true;
+    bool same_text = true;
+    switch (data.type) {
+      case column_type::string:
+        data.chars.append(begin, end);
+        data.offsets.push_back(data.chars.size());
+        return;
+      case column_type::dictionary: {
+        scratch_.assign(begin, end);
+        auto inserted = data.dictionary_index.emplace(scratch_, static_cast<uint32_t>(data.dictionary.size()));
+        if (inserted.second) {
+          data.dictionary.push_back(scratch_);
+        }
+        data.codes.push_back(inserted.first->second);
+        return;
+      }
+      case column_type::int64: {
+        int64_t value = 0;
+        native = detail::parseValue(begin, end, value) == conversion_error::none;
+        data.integers.push_back(native ? value : 0);
+        same_text = native && detail::formatsAs(value, begin, end, scratch_);
+        break;
+      }
+      case column_type::float64: {
+        double value = 0;
+        native = detail::parseValue(begin, end, value) == conversion_error::none;
+        data.reals.push_back(native ? value : 0);
+        same_text = native && detail::formatsAs(value, begin, end, scratch_);
+        break;
+      }
+      case column_type::boolean: {
+        bool value = false;
+        native = detail::parseValue(begin, end, value) == conversion_error::none;
+        data.integers.push_back(native && value ? 1 : 0);
+        same_text = native && detail::formatsAs(value, begin, end, scratch_);
+        break;
+      }
+    }
+    size_t row = rows_;
+    if (!native) {
+      addFallback(data, row, std::string(begin, end));
+      return;
+    }
+    if (!data.fallback.empty()) {
+      data.fallback.push_back(false);
+    }
+    if (!same_text) {
+      data.text_rows.push_back(row);
+      data.text_chars.append(begin, end);
+      data.text_ends.push_back(data.text_chars.size());
+    }
+  }
+
+  static void addFallback(column_data& data, size_t row, std::string value) {
+    data.fallback.resize(row, false);
+    data.fallback.push_back(true);
+    data.fallback_rows.push_back(row);
+    data.fallback_values.push_back(std::move(value));
+  }
+
+  static const std::string& fallbackValue(const column_data& data, size_t row) {
+    size_t i = std::lower_bound(data.fallback_rows.begin(), data.fallback_rows.end(), row) - data.fallback_rows.begin();
+    return data.fallback_values[i];
+  }
+
+  // Array loads for native values of the column's type, or of a type that holds all of them
+  template <typename T>
+  typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value, bool>::type getNative(size_t row, size_t column, T& result) const {
+    return native(row, column) && data_[column].type == column_type::int64 && detail::castInteger(data_[column].integers[row], result);
+  }
+
+  template <typename T>
+  typename std::enable_if<std::is_floating_point<T>::value, bool>::type getNative(size_t row, size_t column, T& result) const {
+    if (!native(row, column)) {
+      return false;
+    }
+    const column_data& data = data_[column];
+    if (data.type == column_type::float64) {
+      result = static_cast<T>(data.reals[row]);
+      return true;
+    }
+    if (data.type == column_type::int64) {
+      result = static_cast<T>(data.integers[row]);
+      return true;
+    }
+    return false;
+  }
+
+  bool getNative(size_t row, size_t column, bool& result) const {
+    if (!native(row, column) || data_[column].type != column_type::boolean) {
+      return false;
+    }
+    result = data_[column].integers[row] != 0;
+    return true;
+  }
+
+  template <typename T>
+  typename std::enable_if<!std::is_arithmetic<T>::value, bool>::type getNative(size_t row, size_t column, T& /* result */) const {
+    checkedColumn(row, column);
+    return false;
+  }
+
+  // Conversions of strings, and of values that don't fit T, like other tables
+  template <typename T>
+  T getText(size_t row, size_t column) const {
+    const column_data& data = data_[column];
+    if (isText(data.type)) {
+      return detail::convert<T>(textView(data, row));
+    }
+    return detail::convert<T>(str(row, column));
+  }
+
+  template <typename T>
+  T getText(size_t row, size_t column, const T& empty_value) const {
+    const column_data& data = data_[column];
+    if (isText(data.type)) {
+      return detail::convert<T>(textView(data, row), empty_value);
+    }
+    return detail::convert<T>(str(row, column), empty_value);
+  }
+
+  std::string scratch_;
+};
+
+// pH::csv::typed_columnar for files with header
+class mapped_typed_columnar : public typed_columnar {
+ public:
+  explicit mapped_typed_columnar(std::istream& in, size_t sample_rows = 1 << 10, size_t dictionary_size = 0) : typed_columnar(), header_(), index_() {
+    read(in, &header_, sample_rows, dictionary_size);
+    index_.assign(header_);
+  }
+
+  explicit mapped_typed_columnar(const std::string& filename, size_t sample_rows = 1 << 10, size_t dictionary_size = 0) : typed_columnar(), header_(), index_() {
+    std::ifstream in(filename, std::ios::in | std::ios::binary);
+    read(in, &header_, sample_rows, dictionary_size);
+    index_.assign(header_);
+  }
+
+  inline const std::vector<std::string>& header() const { return header_; }
+
+  inline size_t headerIndex(const std::string& column) const {
+    return index_.at(column);
+  }
+
+  using typed_columnar::type;
+  inline column_type type(const std::string& column) const { return type(headerIndex(column)); }
+
+  using typed_columnar::integers;
+  inline const std::vector<int64_t>& integers(const std::string& column) const { return integers(headerIndex(column)); }
+
+  using typed_columnar::reals;
+  inline const std::vector<double>& reals(const std::string& column) const { return reals(headerIndex(column)); }
+
+  using typed_columnar::codes;
+  inline const std::vector<uint32_t>& codes(const std::string& column) const { return codes(headerIndex(column)); }
+
+  using typed_columnar::dictionary;
+  inline const std::vector<std::string>& dictionary(const std::string& column) const { return dictionary(headerIndex(column)); }
+
+  using typed_columnar::code;
+  inline uint32_t code(const std::string& column, const std::string& value) const { return code(headerIndex(column), value); }
+
+  using typed_columnar::findRows;
+  inline std::vector<size_t> findRows(const std::string& column, const std::string& value) const { return findRows(headerIndex(column), value); }
+
+  using typed_columnar::groupRows;
+  inline std::vector<std::vector<size_t>> groupRows(const std::string& column) const { return groupRows(headerIndex(column)); }
+
+  using typed_columnar::str;
+  inline std::string str(size_t row, const std::string& column) const { return str(row, headerIndex(column)); }
+
+  using typed_columnar::get;
+  template <typename T = std::string>
+  inline T get(size_t row, const std::string& column) const { return typed_columnar::get<T>(row, headerIndex(column)); }
+  template <typename T>
+  inline T get(size_t row, const std::string& column, const T& empty_value) const { return typed_columnar::get<T>(row, headerIndex(column), empty_value); }
+
+  using typed_columnar::getColumn;
+  template <typename T = std::string>
+  inline std::vector<T> getColumn(const std::string& column) const { return typed_columnar::getColumn<T>(headerIndex(column)); }
+  template <typename T>
+  inline std::vector<T> getColumn(const std::string& column, const T& empty_value) const { return typed_columnar::getColumn<T>(headerIndex(column), empty_value); }
+
+ private:
+  std::vector<std::string> header_;
+  detail::header_map index_;
+};
+
+// Read only table that only records where each field is while reading, and unescapes a field on
+// first access. Saves work when only a few fields of a wide file are used. Accessing fields
+// updates a cache of unescaped fields, so concurrent access must be synchronized.
+class flat_lazy {
+ public:
+  flat_lazy() : buffer_(), fields_(), rows_(1, 0), decoded_(), columns_(0) {}
+
+  flat_lazy(std::istream& in) : flat_lazy() {
+    read(in, nullptr);
+  }
+
+  flat_lazy(const std::string& filename) : flat_lazy() {
+    std::ifstream in(filename, std::ios::in | std::ios::binary);
+    read(in, nullptr);
+  }
+
+  inline size_t rows() const { return rows_.size() - 1; }
+  virtual inline size_t columns() const { return columns_; }
+  inline size_t columns(size_t row) const { return rows_.at(row + 1) - rows_[row]; }
+
+  inline view at(size_t row, size_t column) const {
+    if (column >= columns(row)) {
+      throw std::out_of_range("Column " + std::to_string(column) + " out of bounds");
+    }
+    const lazy_field& field = fields_[rows_[row] + column];
+    if (field.decoded == not_escaped) {
+      return view(buffer_.data() + field.begin, field.size);
+    }
+    if (field.decoded == not_decoded) {
+      decoded_.emplace_back();
+      detail::raw_field raw = {buffer_.data() + field.begin, buffer_.data() + field.begin + field.size, true, true};
+      detail::unescapeCsvField(raw, decoded_.back());
+      field.decoded = static_cast<uint32_t>(decoded_.size() - 1);
+    }
+    return view(decoded_[field.decoded]);
+  }
+
+  template <typename T = std::string>
+  inline T get(size_t row, size_t column) const {
+    return detail::convert<T>(at(row, column));
+  }
+
+  template <typename T>
+  inline T get(size_t row, size_t column, const T& empty_value) const {
+    return detail::convert<T>(at(row, column), empty_value);
+  }
+
+  template <typename T = std::string>
+  std::vector<T> getColumn(size_t column) const {
+    std::vector<T> result;
+    result.reserve(rows());
+    for (size_t row = 0; row < rows(); row++) {
+      result.push_back(detail::convert<T>(at(row, column)));
+    }
+    return result;
+  }
+
+  template <typename T>
+  std::vector<T> getColumn(size_t column, const T& empty_value) const {
+    std::vector<T> result;
+    result.reserve(rows());
+    for (size_t row = 0; row < rows(); row++) {
+      result.push_back(detail::convert<T>(at(row, column), empty_value));
+    }
+    return result;
+  }
+
+  virtual ~flat_lazy() = default;
+
+ protected:
+  // Reads the header, if not null, and pads all rows to its size
+  void read(std::istream& in, std::vector<std::string>* header) {
+    if (in.bad() || in.fail()) {
+      throw std::runtime_error("Bad input");
+    }
+    detail::readAll(in, buffer_);
+    detail::tokenizer tokens(buffer_.data(), buffer_.data() + buffer_.size(), true);
+    std::vector<detail::raw_field> row;
+    if (header != nullptr && !tokens.done()) {
+      detail::readRawRow(tokens, row);
+      header->resize(row.size());
+      for (size_t i = 0; i < row.size(); i++) {
+        detail::unescapeCsvField(row[i], (*header)[i]);
+      }
+    }
+    size_t min_columns = header != nullptr ? header->size() : 0;
+    while (!tokens.done()) {
+      row.clear();
+      detail::readRawRow(tokens, row);
+      for (const detail::raw_field& field : row) {
+        if (static_cast<size_t>(field.end - field.begin) >= not_decoded) {
+          throw std::runtime_error("Field too large");
+        }
+        fields_.push_back(lazy_field{static_cast<size_t>(field.begin - buffer_.data()), static_cast<uint32_t>(field.end - field.begin), field.escaped ? not_decoded : not_escaped});
+      }
+      for (size_t i = row.size(); i < min_columns; i++) {
+        fields_.push_back(lazy_field{0, 0, not_escaped});
+      }
+      rows_.push_back(fields_.size());
+      columns_ = std::max(columns_, row.size());
+    }
+  }
+
+ private:
+  static const uint32_t not_escaped = 0xffffffff;
+  static const uint32_t not_decoded = 0xfffffffe;
+
+  // Offset instead of pointer into buffer_, which keeps it valid when the table is moved
+  struct lazy_field {
+    size_t begin;
+    uint32_t size;
+    mutable uint32_t decoded;  // index in decoded_ once unescaped, or one of the values above
+  };
+
+  std::string buffer_;
+  std::vector<lazy_field> fields_;
+  std::vector<size_t> rows_;  // rows_[i] is the index in fields_ of the first field in row i
+  mutable std::deque<std::string> decoded_;  // deque to keep views of decoded fields valid
+  size_t columns_;
+};
+
+// pH::csv::mapped equivalent of pH::csv::flat_lazy
+class mapped_lazy : public flat_lazy {
+ public:
+  mapped_lazy(std::istream& in) : flat_lazy(), header_(), index_() {
+    read(in, &header_);
+    index_.assign(header_);
+  }
+
+  mapped_lazy(const std::string& filename) : flat_lazy(), header_(), index_() {
+    std::ifstream in(filename, std::ios::in | std::ios::binary);
+    read(in, &header_);
+    index_.assign(header_);
+  }
+
+  inline const std::vector<std::string>& header() const { return header_; }
+
+  inline size_t headerIndex(const std::string& column) const {
+    return index_.at(column);
+  }
+
+  inline column_handle column(const std::string& column) const { return column_handle(headerIndex(column)); }
+
+  using flat_lazy::at;
+  inline view at(size_t row, const std::string& column) const { return at(row, headerIndex(column)); }
+  inline view at(size_t row, column_handle column) const { return at(row, column.index()); }
+
+  using flat_lazy::get;
+  template <typename T = std::string>
+  inline T get(size_t row, const std::string& column) const { return flat_lazy::get<T>(row, headerIndex(column)); }
+  template <typename T>
+  inline T get(size_t row, const std::string& column, const T& empty_value) const { return flat_lazy::get<T>(row, headerIndex(column), empty_value); }
+  template <typename T = std::string>
+  inline T get(size_t row, column_handle column) const { return flat_lazy::get<T>(row, column.index()); }
+  template <typename T>
+  inline T get(size_t row, column_handle column, const T& empty_value) const { return flat_lazy::get<T>(row, column.index(), empty_value); }
+
+  using flat_lazy::getColumn;
+  template <typename T = std::string>
+  inline std::vector<T> getColumn(const std::string& column) const { return flat_lazy::getColumn<T>(headerIndex(column)); }
+  template <typename T>
+  inline std::vector<T> getColumn(const std::string& column, const T& empty_value) const { return flat_lazy::getColumn<T>(headerIndex(column), empty_value); }
+
+  inline size_t columns() const override { return header_.size(); }
+
+ private:
+  std::vector<std::string> header_;
+  detail::header_map index_;
+};
+
+// Row of streamRows with lazy unescaping, fields are unescaped on first access. Views are only valid
+// during the call to parse_func.
+class mapped_lazy_row {
+ public:
+  mapped_lazy_row(const std::vector<std::string>& header, const detail::header_map& index, const std::vector<detail::raw_field>& fields, detail::lazy_cache& cache)
+    : header_(header), index_(index), fields_(fields), cache_(cache) {}
+  mapped_lazy_row() = delete;
+  mapped_lazy_row(const mapped_lazy_row& other) = delete;
+  mapped_lazy_row(mapped_lazy_row&& other) = delete;
+  mapped_lazy_row& operator=(const mapped_lazy_row& other) = delete;
+  mapped_lazy_row& operator=(mapped_lazy_row&& other) = delete;
+
+  inline size_t size() const { return std::max(fields_.size(), header_.size()); }
+
+  inline column_handle column(const std::string& column) const { return column_handle(index_.at(column)); }
+
+  inline view at(const std::string& column) const { return at(index_.at(column)); }
+
+  inline view at(size_t column) const {
+    if (column >= size()) {
+      throw std::runtime_error("Column " + std::to_string(column) + " out of bounds");
+    }
+    return column < fields_.size() ? cache_.decode(column, fields_[column]) : view();
+  }
+
+  inline view at(column_handle column) const { return at(column.index()); }
+
+  template <typename T = std::string>
+  inline T get(const std::string& column) const { return detail::convert<T>(at(column)); }
+  template <typename T = std::string>
+  inline T get(size_t column) const { return detail::convert<T>(at(column)); }
+  template <typename T = std::string>
+  inline T get(column_handle column) const { return detail::convert<T>(at(column)); }
+  template <typename T>
+  inline T get(const std::string& column, const T& empty_value) const { return detail::convert<T>(at(column), empty_value); }
+  template <typename T>
+  inline T get(size_t column, const T& empty_value) const { return detail::convert<T>(at(column), empty_value); }
+  template <typename T>
+  inline T get(column_handle column, const T& empty_value) const { return detail::convert<T>(at(column), empty_value); }
+
+ private:
+  const std::vector<std::string>& header_;
+  const detail::header_map& index_;
+  const std::vector<detail::raw_field>& fields_;
+  detail::lazy_cache& cache_;
+};
+
+inline void streamRows(std::istream& in, std::function<void(const mapped_row&)> parse_func) {
+  if (in.bad() || in.fail()) {
+    throw std::runtime_error("Bad input");
+  }
+  detail::block_reader reader(in);
+  std::vector<std::string> header;
+  reader.readRow(header);
+  detail::header_map index(header);
+  std::vector<std::string> row;
+  while (reader.readRow(row, header.size())) {
+    parse_func(mapped_row(header, index, row));
+  }
+}
+
+inline void streamRows(const std::string& filename, std::function<void(const mapped_row&)> parse_func) {
+  std::ifstream in(filename, std::ios::in | std::ios::binary);
+  streamRows(in, parse_func);
+}
+
+inline void streamRows(std::istream& in, std::function<void(const std::vector<std::string>&)> parse_func) {
+  if (in.bad() || in.fail()) {
+    throw std::runtime_error("Bad input");
+  }
+  detail::block_reader reader(in);
+  std::vector<std::string> row;
+  while (reader.readRow(row)) {
+    parse_func(row);
+  }
+}
+
+inline void streamRows(const std::string& filename, std::function<void(const std::vector<std::string>&)> parse_func) {
+  std::ifstream in(filename, std::ios::in | std::ios::binary);
+  streamRows(in, parse_func);
+}
+
+// Streams a file in another dialect, such as pH::csv::tsv_dialect()
+template <char Separator, char Quote, bool Crlf>
+void streamRows(std::istream& in, dialect<Separator, Quote, Crlf>, std::function<void(const mapped_row&)> parse_func) {
+  if (in.bad() || in.fail()) {
+    throw std::runtime_error("Bad input");
+  }
+  detail::basic_block_reader<dialect<Separator, Quote, Crlf>> reader(in);
+  std::vector<std::string> header;
+  reader.readRow(header);
+  detail::header_map index(header);
+  std::vector<std::string> row;
+  while (reader.readRow(row, header.size())) {
+    parse_func(mapped_row(header, index, row));
+  }
+}
+
+template <char Separator, char Quote, bool Crlf>
+void streamRows(const std::string& filename, dialect<Separator, Quote, Crlf> format, std::function<void(const mapped_row&)> parse_func) {
+  std::ifstream in(filename, std::ios::in | std::ios::binary);
+  streamRows(in, format, parse_func);
+}
+
+template <char Separator, char Quote, bool Crlf>
+void streamRows(std::istream& in, dialect<Separator, Quote, Crlf>, std::function<void(const std::vector<std::string>&)> parse_func) {
+  if (in.bad() || in.fail()) {
+    throw std::runtime_error("Bad input");
+  }
+  detail::basic_block_reader<dialect<Separator, Quote, Crlf>> reader(in);
+  std::vector<std::string> row;
+  while (reader.readRow(row)) {
+    parse_func(row);
+  }
+}
+
+template <char Separator, char Quote, bool Crlf>
+void streamRows(const std::string& filename, dialect<Separator, Quote, Crlf> format, std::function<void(const std::vector<std::string>&)> parse_func) {
+  std::ifstream in(filename, std::ios::in | std::ios::binary);
+  streamRows(in, format, parse_func);
+}
+
+// Only records where fields are, and unescapes fields when accessed through the mapped_lazy_row
+inline void streamRows(std::istream& in, std::function<void(const mapped_lazy_row&)> parse_func) {
+  if (in.bad() || in.fail()) {
+    throw std::runtime_error("Bad input");
+  }
+  detail::block_reader reader(in);
+  std::vector<std::string> header;
+  reader.readRow(header);
+  detail::header_map index(header);
+  detail::lazy_cache cache;
+  std::vector<detail::raw_field> fields;
+  while (reader.readFields(fields)) {
+    cache.nextRow(fields.size());
+    parse_func(mapped_lazy_row(header, index, fields, cache));
+  }
+}
+
+inline void streamRows(const std::string& filename, std::function<void(const mapped_lazy_row&)> parse_func) {
+  std::ifstream in(filename, std::ios::in | std::ios::binary);
+  streamRows(in, parse_func);
+}
+
+// Rows only contain the projected columns, in the given order
+inline void streamRows(std::istream& in, const projection& columns, std::function<void(const mapped_row&)> parse_func) {
+  detail::streamSelectedRows(in, true, &columns, nullptr, [&parse_func] (const std::vector<std::string>& header, const detail::header_map& index, const std::vector<std::string>& row) {
+    parse_func(mapped_row(header, index, row));
+  });
+}
+
+inline void streamRows(const std::string& filename, const projection& columns, std::function<void(const mapped_row&)> parse_func) {
+  std::ifstream in(filename, std::ios::in | std::ios::binary);
+  streamRows(in, columns, parse_func);
+}
+
+inline void streamRows(std::istream& in, const projection& columns, std::function<void(const std::vector<std::string>&)> parse_func) {
+  detail::streamSelectedRows(in, false, &columns, nullptr, [&parse_func] (const std::vector<std::string>&, const detail::header_map&, const std::vector<std::string>& row) {
+    parse_func(row);
+  });
+}
+
+inline void streamRows(const std::string& filename, const projection& columns, std::function<void(const std::vector<std::string>&)> parse_func) {
+  std::ifstream in(filename, std::ios::in | std::ios::binary);
+  streamRows(in, columns, parse_func);
+}
+
+// Only rows matching the filter are read and passed to parse_func
+inline void streamRows(std::istream& in, const filter& rows, std::function<void(const mapped_row&)> parse_func) {
+  detail::streamSelectedRows(in, true, nullptr, &rows, [&parse_func] (const std::vector<std::string>& header, const detail::header_map& index, const std::vector<std::string>& row) {
+    parse_func(mapped_row(header, index, row));
+  });
+}
+
+inline void streamRows(const std::string& filename, const filter& rows, std::function<void(const mapped_row&)> parse_func) {
+  std::ifstream in(filename, std::ios::in | std::ios::binary);
+  streamRows(in, rows, parse_func);
+}
+
+inline void streamRows(std::istream& in, const filter& rows, std::function<void(const std::vector<std::string>&)> parse_func) {
+  detail::streamSelectedRows(in, false, nullptr, &rows, [&parse_func] (const std::vector<std::string>&, const detail::header_map&, const std::vector<std::string>& row) {
+    parse_func(row);
+  });
+}
+
+inline void streamRows(const std::string& filename, const filter& rows, std::function<void(const std::vector<std::string>&)> parse_func) {
+  std::ifstream in(filename, std::ios::in | std::ios::binary);
+  streamRows(in, rows, parse_func);
+}
+
+inline void streamRows(std::istream& in, const projection& columns, const filter& rows, std::function<void(const mapped_row&)> parse_func) {
+  detail::streamSelectedRows(in, true, &columns, &rows, [&parse_func] (const std::vector<std::string>& header, const detail::header_map& index, const std::vector<std::string>& row) {
+    parse_func(mapped_row(header, index, row));
+  });
+}
+
+inline void streamRows(const std::string& filename, const projection& columns, const filter& rows, std::function<void(const mapped_row&)> parse_func) {
+  std::ifstream in(filename, std::ios::in | std::ios::binary);
+  streamRows(in, columns, rows, parse_func);
+}
+
+namespace detail {
+
+// State of a row range, kept on the heap so rows stay valid when the range is moved
+struct range_state {
+  range_state(std::unique_ptr<std::istream> owned, std::istream& in, size_t block_size)
+    : owned(std::move(owned)), reader(checkedInput(in), block_size), header(), index(), row(), mapped(), started(false), done(false) {}
+
+  static std::istream& checkedInput(std::istream& in) {
+    if (in.bad() || in.fail()) {
+      throw std::runtime_error("Bad input");
+    }
+    return in;
+  }
+
+  // Reads the first row the first time, so a range reads nothing until it is iterated
+  void start() {
+    if (!started) {
+      started = true;
+      advance();
+    }
+  }
+
+  void advance() {
+    done = done || !reader.readRow(row, header.size());
+  }
+
+  std::unique_ptr<std::istream> owned;
+  block_reader reader;
+  std::vector<std::string> header;
+  header_map index;
+  std::vector<std::string> row;
+  std::unique_ptr<mapped_row> mapped;  // refers to header, index and row
+  bool started;
+  bool done;
+};
+
+// Result of postfix increment on a range_iterator, which holds a copy of the row before the increment
+template <typename Row>
+class range_postfix;
+
+template <>
+class range_postfix<std::vector<std::string>> {
+ public:
+  explicit range_postfix(const range_state& state) : row_(state.row) {}
+
+  inline const std::vector<std::string>& operator*() const { return row_; }
+  inline const std::vector<std::string>* operator->() const { return &row_; }
+
+ private:
+  std::vector<std::string> row_;
+};
+
+template <>
+class range_postfix<mapped_row> {
+ public:
+  explicit range_postfix(const range_state& state) : state_(state), data_(state.row), row_(state.header, state.index, data_) {}
+  range_postfix(const range_postfix& other) : state_(other.state_), data_(other.data_), row_(state_.header, state_.index, data_) {}
+  range_postfix& operator=(const range_postfix& other) = delete;
+
+  inline const mapped_row& operator*() const { return row_; }
+  inline const mapped_row* operator->() const { return &row_; }
+
+ private:
+  const range_state& state_;
+  std::vector<std::string> data_;
+  mapped_row row_;  // refers to the header of state_ and to data_
+};
+
+// Input iterator over the rows of a range_state, equal to the end iterator after the last row
+template <typename Row>
+class range_iterator {
+ public:
+  typedef std::input_iterator_tag iterator_category;
+  typedef Row value_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef const Row* pointer;
+  typedef const Row& reference;
+
+  range_iterator() : state_(nullptr) {}
+  explicit range_iterator(range_state* state) : state_(state != nullptr && !state->done ? state : nullptr) {}
+
+  inline reference operator*() const { return row(); }
+  inline pointer operator->() const { return &row(); }
+
+  range_iterator& operator++() {
+    state_->advance();
+    if (state_->done) {
+      state_ = nullptr;
+    }
+    return *this;
+  }
+
+  // Input iterators share the position, so the row before the increment is returned as a copy
+  range_postfix<Row> operator++(int) {
+    range_postfix<Row> previous(*state_);
+    ++*this;
+    return previous;
+  }
+
+  inline bool operator==(const range_iterator& other) const { return state_ == other.state_; }
+  inline bool operator!=(const range_iterator& other) const { return state_ != other.state_; }
+
+ private:
+  inline const Row& row() const;
+
+  range_state* state_;
+};
+
+template <>
+inline const std::vector<std::string>& range_iterator<std::vector<std::string>>::row() const { return state_->row; }
+
+template <>
+inline const mapped_row& range_iterator<mapped_row>::row() const { return *state_->mapped; }
+
+}  // namespace detail
+
+// Range over the rows of a stream, for range-for loops. Rows are read one at a time as the loop
+// advances, into the same buffer, so breaking out of the loop stops reading. Input is read in
+// blocks of block_size bytes, so at most one block past the last row is read.
+class row_range {
+ public:
+  typedef detail::range_iterator<std::vector<std::string>> iterator;
+
+  explicit row_range(std::istream& in, size_t block_size = 1 << 16) : state_(new detail::range_state(nullptr, in, block_size)) {}
+
+  explicit row_range(const std::string& filename, size_t block_size = 1 << 16) : state_() {
+    std::unique_ptr<std::istream> in(new std::ifstream(filename, std::ios::in | std::ios::binary));
+    std::istream& stream = *in;
+    state_.reset(new detail::range_state(std::move(in), stream, block_size));
+  }
+
+  // The next row to read, the range can only be iterated once
+  iterator begin() {
+    state_->start();
+    return iterator(state_.get());
+  }
+
+  inline iterator end() const { return iterator(); }
+
+ private:
+  std::unique_ptr<detail::range_state> state_;
+};
+
+// pH::csv::row_range for files with header, rows are pH::csv::mapped_rows. The header is read when
+// the range is created.
+class mapped_row_range {
+ public:
+  typedef detail::range_iterator<mapped_row> iterator;
+
+  explicit mapped_row_range(std::istream& in, size_t block_size = 1 << 16) : state_(new detail::range_state(nullptr, in, block_size)) {
+    readHeader();
+  }
+
+  explicit mapped_row_range(const std::string& filename, size_t block_size = 1 << 16) : state_() {
+    std::unique_ptr<std::istream> in(new std::ifstream(filename, std::ios::in | std::ios::binary));
+    std::istream& stream = *in;
+    state_.reset(new detail::range_state(std::move(in), stream, block_size));
+    readHeader();
+  }
+
+  inline const std::vector<std::string>& header() const { return state_->header; }
+
+  iterator begin() {
+    state_->start();
+    return iterator(state_.get());
+  }
+
+  inline iterator end() const { return iterator(); }
+
+ private:
+  void readHeader() {
+    state_->reader.readRow(state_->header);
+    state_->index.assign(state_->header);
+    state_->mapped.reset(new mapped_row(state_->header, state_->index, state_->row));
+  }
+
+  std::unique_ptr<detail::range_state> state_;
+};
+
+namespace detail {
+
+// Rows of a batch, which keep their storage between batches
+class batch_storage {
+ public:
+  batch_storage() : rows_(), size_(0) {}
+
+  inline size_t size() const { return size_; }
+  inline bool empty() const { return size_ == 0; }
+
+  inline std::vector<std::vector<std::string>>::const_iterator begin() const { return rows_.begin(); }
+  inline std::vector<std::vector<std::string>>::const_iterator end() const { return rows_.begin() + size_; }
+
+  inline const std::vector<std::string>& operator[](size_t row) const { return rows_[row]; }
+
+  inline const std::vector<std::string>& at(size_t row) const {
+    if (row >= size_) {
+      throw std::out_of_range("Row " + std::to_string(row) + " out of bounds");
+    }
+    return rows_[row];
   }
 
+  inline const std::string& at(size_t row, size_t column) const { return at(row).at(column); }
+
   template <typename T = std::string>
-  inline T get(const std::string& column) const { return detail::convert<T>(at(column)); }
+  inline T get(size_t row, size_t column) const { return detail::convert<T>(at(row, column)); }
+  template <typename T>
+  inline T get(size_t row, size_t column, const T& empty_value) const { return detail::convert<T>(at(row, column), empty_value); }
+
+  // Reads up to batch_size rows into the storage of the previous batch. Returns false if no rows
+  // were left.
+  bool read(block_reader& reader, size_t batch_size, size_t min_columns) {
+    if (rows_.size() < batch_size) {
+      rows_.resize(batch_size);
+    }
+    size_ = 0;
+    while (size_ < batch_size && reader.readRow(rows_[size_], min_columns)) {
+      size_++;
+    }
+    return size_ > 0;
+  }
+
+ private:
+  std::vector<std::vector<std::string>> rows_;
+  size_t size_;
+};
+
+}  // namespace detail
+
+// Batch of rows from streamBatches for files without header
+class row_batch : public detail::batch_storage {};
+
+// Batch of rows from streamBatches for files with header
+class mapped_row_batch : public detail::batch_storage {
+ public:
+  explicit mapped_row_batch(std::vector<std::string> header) : batch_storage(), header_(std::move(header)), index_(header_) {}
+
+  inline const std::vector<std::string>& header() const { return header_; }
+
+  inline size_t headerIndex(const std::string& column) const { return index_.at(column); }
+
+  inline column_handle column(const std::string& column) const { return column_handle(headerIndex(column)); }
+
+  using batch_storage::at;
+  inline const std::string& at(size_t row, const std::string& column) const { return at(row, headerIndex(column)); }
+  inline const std::string& at(size_t row, column_handle column) const { return at(row, column.index()); }
+
+  using batch_storage::get;
   template <typename T = std::string>
-  inline T get(size_t column) const { return detail::convert<T>(at(column)); }
+  inline T get(size_t row, const std::string& column) const { return batch_storage::get<T>(row, headerIndex(column)); }
+  template <typename T>
+  inline T get(size_t row, const std::string& column, const T& empty_value) const { return batch_storage::get<T>(row, headerIndex(column), empty_value); }
+  template <typename T = std::string>
+  inline T get(size_t row, column_handle column) const { return batch_storage::get<T>(row, column.index()); }
+  template <typename T>
+  inline T get(size_t row, column_handle column, const T& empty_value) const { return batch_storage::get<T>(row, column.index(), empty_value); }
 
  private:
-  const std::vector<std::string>& header_;
-  const std::vector<std::string>& data_;
+  std::vector<std::string> header_;
+  detail::header_map index_;
 };
 
-class mapped : public flat {
+// Streams rows in batches of up to batch_size rows. The rows and their strings are reused for the
+// next batch, so reading needs no allocations once the storage has grown, but the rows are only
+// valid during the call to parse_func.
+inline void streamBatches(std::istream& in, size_t batch_size, std::function<void(const mapped_row_batch&)> parse_func) {
+  if (in.bad() || in.fail()) {
+    throw std::runtime_error("Bad input");
+  }
+  detail::block_reader reader(in);
+  std::vector<std::string> header;
+  reader.readRow(header);
+  mapped_row_batch batch(std::move(header));
+  while (batch.read(reader, std::max<size_t>(batch_size, 1), batch.header().size())) {
+    parse_func(batch);
+  }
+}
+
+inline void streamBatches(const std::string& filename, size_t batch_size, std::function<void(const mapped_row_batch&)> parse_func) {
+  std::ifstream in(filename, std::ios::in | std::ios::binary);
+  streamBatches(in, batch_size, parse_func);
+}
+
+inline void streamBatches(std::istream& in, size_t batch_size, std::function<void(const row_batch&)> parse_func) {
+  if (in.bad() || in.fail()) {
+    throw std::runtime_error("Bad input");
+  }
+  detail::block_reader reader(in);
+  row_batch batch;
+  while (batch.read(reader, std::max<size_t>(batch_size, 1), 0)) {
+    parse_func(batch);
+  }
+}
+
+inline void streamBatches(const std::string& filename, size_t batch_size, std::function<void(const row_batch&)> parse_func) {
+  std::ifstream in(filename, std::ios::in | std::ios::binary);
+  streamBatches(in, batch_size, parse_func);
+}
+
+// Byte offsets of every stride-th row of a CSV file, so any range of rows can be read without
+// parsing the rows before it. Rows are counted like pH::csv::flat counts them, including the
+// header, and newlines in quoted fields don't start rows.
+class row_index {
  public:
-  mapped(std::istream& in) : flat(), header_() {
-    detail::readStream(in, data_, &header_);
+  row_index() : stride_(1), rows_(0), size_(0), offsets_() {}
+
+  // Scans in once, from its start
+  explicit row_index(std::istream& in, size_t stride = 1 << 10) : row_index() {
+    build(in, stride);
   }
 
-  mapped(const std::string& filename) : flat(), header_() {
+  explicit row_index(const std::string& filename, size_t stride = 1 << 10) : row_index() {
     std::ifstream in(filename, std::ios::in | std::ios::binary);
-    detail::readStream(in, data_, &header_);
+    build(in, stride);
   }
 
-  mapped(std::vector<std::string> header, flat data = flat()) : flat(std::move(data)), header_(std::move(header)) {}
+  inline size_t rows() const { return rows_; }
+  inline size_t stride() const { return stride_; }
+  // Size of the indexed input, used to detect changed files
+  inline uint64_t size() const { return size_; }
 
-  void write(std::ostream& out) const override {
-    detail::writeStream(out, data_, &header_);
+  // Offset of the last indexed row at or before row
+  inline uint64_t offset(size_t row) const { return offsets_.at(row / stride_); }
+
+  // Saves the index in a binary format, in the byte order of this machine
+  void write(std::ostream& out) const {
+    if (out.bad() || out.fail()) {
+      throw std::runtime_error("Bad output");
+    }
+    uint64_t info[5] = {magic(), stride_, rows_, size_, offsets_.size()};
+    out.write(reinterpret_cast<const char*>(info), sizeof(info));
+    out.write(reinterpret_cast<const char*>(offsets_.data()), offsets_.size() * sizeof(uint64_t));
+    if (out.bad() || out.fail()) {
+      throw std::runtime_error("Bad output");
+    }
   }
 
-  void write(const std::string& filename) const override {
+  void write(const std::string& filename) const {
     std::ofstream out(filename, std::ios::out | std::ios::binary);
-    detail::writeStream(out, data_, &header_);
+    write(out);
   }
 
-  void write(std::ostream& out, bool skip_header) const {
-    detail::writeStream(out, data_, skip_header ? nullptr : &header_);
+  // Loads an index saved by write
+  void read(std::istream& in) {
+    if (in.bad() || in.fail()) {
+      throw std::runtime_error("Bad input");
+    }
+    uint64_t info[5];
+    if (!in.read(reinterpret_cast<char*>(info), sizeof(info)) || info[0] != magic() || info[1] == 0 ||
+        info[4] != (info[2] + info[1] - 1) / info[1]) {
+      throw std::runtime_error("Bad row index");
+    }
+    std::vector<uint64_t> offsets(info[4]);
+    if (!in.read(reinterpret_cast<char*>(offsets.data()), offsets.size() * sizeof(uint64_t))) {
+      throw std::runtime_error("Bad row index");
+    }
+    stride_ = info[1];
+    rows_ = info[2];
+    size_ = info[3];
+    offsets_ = std::move(offsets);
   }
 
-  void write(const std::string& filename, bool skip_header) const {
-    std::ofstream out(filename, std::ios::out | std::ios::binary);
-    detail::writeStream(out, data_, skip_header ? nullptr : &header_);
+  void read(const std::string& filename) {
+    std::ifstream in(filename, std::ios::in | std::ios::binary);
+    read(in);
   }
 
-  inline size_t headerIndex(const std::string& column) const {
-      return detail::headerIndex(header_, column);
+ private:
+  static uint64_t magic() { return 0x3178697673634870ull; }  // "pHcsvix1"
+
+  void build(std::istream& in, size_t stride) {
+    if (in.bad() || in.fail()) {
+      throw std::runtime_error("Bad input");
+    }
+    stride_ = std::max<size_t>(stride, 1);
+    detail::block_reader reader(in);
+    std::vector<detail::raw_field> fields;
+    while (true) {
+      uint64_t position = reader.position();
+      if (!reader.readFields(fields)) {
+        size_ = position;
+        break;
+      }
+      if (rows_ % stride_ == 0) {
+        offsets_.push_back(position);
+      }
+      rows_++;
+    }
   }
 
-  using flat::at;
-  inline std::string& at(size_t row, const std::string& column) { return data_.at(row).at(headerIndex(column)); }
-  inline const std::string& at(size_t row, const std::string& column) const { return data_.at(row).at(headerIndex(column)); }
+  size_t stride_;
+  size_t rows_;
+  uint64_t size_;
+  std::vector<uint64_t> offsets_;
+};
 
-  void emplaceRow() override { data_.emplace_back(header_.size(), ""); }
+namespace detail {
 
-  void resizeColumns(size_t size) override {
-    if (size > header_.size()) {
-      throw std::runtime_error("Can not increase number of headers with pH::csv::mapped::resizeColumns");
+// Positions a reader at row of an indexed input, which must be seekable and unchanged since it was
+// indexed. The reader must be created after the call.
+inline void seekRow(std::istream& in, const row_index& index, size_t row) {
+  if (in.bad() || in.fail()) {
+    throw std::runtime_error("Bad input");
+  }
+  in.seekg(0, std::ios::end);
+  if (in.fail() || static_cast<uint64_t>(in.tellg()) != index.size()) {
+    throw std::runtime_error("Row index does not match input");
+  }
+  in.seekg(static_cast<std::streamoff>(row < index.rows() ? index.offset(row) : index.size()));
+}
+
+// Skips to row, from the indexed row before it
+inline void skipRows(block_reader& reader, const row_index& index, size_t row) {
+  std::vector<raw_field> fields;
+  for (size_t i = row - row % index.stride(); i < row && i < index.rows(); i++) {
+    reader.readFields(fields);
+  }
+}
+
+}  // namespace detail
+
+// Streams count rows starting at row first, seeking to them with the index. Stops at the end of
+// the input if there are fewer rows.
+inline void streamRows(std::istream& in, const row_index& index, size_t first, size_t count, std::function<void(const std::vector<std::string>&)> parse_func) {
+  detail::seekRow(in, index, first);
+  detail::block_reader reader(in);
+  detail::skipRows(reader, index, first);
+  std::vector<std::string> row;
+  for (size_t i = 0; i < count && reader.readRow(row); i++) {
+    parse_func(row);
+  }
+}
+
+inline void streamRows(const std::string& filename, const row_index& index, size_t first, size_t count, std::function<void(const std::vector<std::string>&)> parse_func) {
+  std::ifstream in(filename, std::ios::in | std::ios::binary);
+  streamRows(in, index, first, count, parse_func);
+}
+
+// As above, for files with header. first is the row after the header, so data row 0 is row 1
+// of the index.
+inline void streamRows(std::istream& in, const row_index& index, size_t first, size_t count, std::function<void(const mapped_row&)> parse_func) {
+  detail::seekRow(in, index, 0);
+  std::vector<std::string> header;
+  {
+    detail::block_reader reader(in);
+    reader.readRow(header);
+  }
+  detail::header_map header_index(header);
+  in.clear();
+  detail::seekRow(in, index, first + 1);
+  detail::block_reader reader(in);
+  detail::skipRows(reader, index, first + 1);
+  std::vector<std::string> row;
+  for (size_t i = 0; i < count && reader.readRow(row, header.size()); i++) {
+    parse_func(mapped_row(header, header_index, row));
+  }
+}
+
+inline void streamRows(const std::string& filename, const row_index& index, size_t first, size_t count, std::function<void(const mapped_row&)> parse_func) {
+  std::ifstream in(filename, std::ios::in | std::ios::binary);
+  streamRows(in, index, first, count, parse_func);
+}
+
+// Shape of a CSV input, from pH::csv::scanShape
+struct shape {
+  uint64_t size;  // bytes
+  size_t rows;  // including the header
+  size_t min_columns;
+  size_t max_columns;
+  std::vector<size_t> row_counts;  // row_counts[n] rows have n fields
+  size_t ragged_rows;  // rows with another number of fields than the first row
+  size_t malformed_rows;  // rows with quotes in unquoted fields, unpaired quotes or unterminated quotes
+  std::vector<uint64_t> ragged_offsets;  // byte offsets of the first ragged rows
+  std::vector<uint64_t> malformed_offsets;
+};
+
+namespace detail {
+
+// True if a quoted field contains a quote that isn't doubled
+template <typename Dialect>
+inline bool unpairedQuote(const raw_field& field) {
+  const char* pos = field.begin;
+  while (pos != field.end) {
+    pos = static_cast<const char*>(std::memchr(pos, Dialect::quote, field.end - pos));
+    if (pos == nullptr) {
+      return false;
+    }
+    const char* run = pos;
+    while (pos != field.end && *pos == Dialect::quote) {
+      pos++;
+    }
+    if ((pos - run) % 2 == 1) {
+      return true;
     }
-    header_.resize(size);
-    flat::resizeColumns(size);
   }
+  return false;
+}
 
-  inline size_t columns() const override { return header_.size(); }
+inline void recordRow(size_t& count, std::vector<uint64_t>& offsets, uint64_t offset, size_t max_offsets) {
+  count++;
+  if (offsets.size() < max_offsets) {
+    offsets.push_back(offset);
+  }
+}
 
-  inline void emplaceColumn(const std::string& column) {
-    if (std::find(header_.begin(), header_.end(), column) == header_.end()) {
-      header_.push_back(column);
-      for (auto& row : data_) {
-        row.emplace_back();
-      }
+}  // namespace detail
+
+// Counts rows and fields per row in one scan, without copying any field, to check the shape of an
+// input before loading it. The byte offsets of the first max_offsets ragged and malformed rows are
+// recorded. Rows are split like all readers split them, so a malformed row may contain the rows
+// that were meant to follow it.
+template <typename Dialect = csv_dialect>
+shape scanShape(std::istream& in, size_t max_offsets = 1 << 10) {
+  if (in.bad() || in.fail()) {
+    throw std::runtime_error("Bad input");
+  }
+  shape result = {0, 0, 0, 0, {}, 0, 0, {}, {}};
+  detail::basic_block_reader<Dialect> reader(in);
+  std::vector<detail::raw_field> fields;
+  size_t first_columns = 0;
+  uint64_t offset = 0;
+  uint64_t last_offset = 0;
+  uint64_t quoted_end = 0;  // offset of the end of the last field of the last row, if it is quoted
+  bool last_malformed = false;
+  while (reader.readFields(fields)) {
+    size_t columns = fields.size();
+    if (columns >= result.row_counts.size()) {
+      result.row_counts.resize(columns + 1, 0);
+    }
+    result.row_counts[columns]++;
+    if (result.rows == 0) {
+      first_columns = columns;
+      result.min_columns = columns;
+      result.max_columns = columns;
+    } else if (columns != first_columns) {
+      detail::recordRow(result.ragged_rows, result.ragged_offsets, offset, max_offsets);
+    }
+    result.min_columns = std::min(result.min_columns, columns);
+    result.max_columns = std::max(result.max_columns, columns);
+    result.rows++;
+    last_malformed = false;
+    for (const auto& field : fields) {
+      last_malformed = last_malformed || (field.escaped && (!field.quoted || detail::unpairedQuote<Dialect>(field)));
+    }
+    if (last_malformed) {
+      detail::recordRow(result.malformed_rows, result.malformed_offsets, offset, max_offsets);
+    }
+    const detail::raw_field& first = fields.front();
+    const detail::raw_field& last = fields.back();
+    quoted_end = last.quoted ? offset + static_cast<uint64_t>(last.end - (first.begin - (first.quoted ? 1 : 0))) : 0;
+    last_offset = offset;
+    offset = reader.position();
+  }
+  result.size = offset;
+  // The closing quote of a quoted field is at its end, unless the input ended first
+  if (result.rows > 0 && quoted_end == result.size && !last_malformed) {
+    detail::recordRow(result.malformed_rows, result.malformed_offsets, last_offset, max_offsets);
+  }
+  return result;
+}
+
+inline shape scanShape(const std::string& filename, size_t max_offsets = 1 << 10) {
+  std::ifstream in(filename, std::ios::in | std::ios::binary);
+  return scanShape(in, max_offsets);
+}
+
+// Follows a file that is still being appended to, like tail -f. Each poll reads the rows appended
+// since the previous one, and a row is only read once the newline ending it is written. The
+// position can be saved with write and restored with read, to resume following after a restart
+// without parsing the file again.
+class follower {
+ public:
+  explicit follower(const std::string& filename, bool has_header = true)
+    : filename_(filename), has_header_(has_header), header_(), index_(), rows_(0), start_(0), read_(0), in_(), reader_(), row_() {
+    reset(0);
+  }
+
+  follower(const follower& other) = delete;
+  follower& operator=(const follower& other) = delete;
+
+  // Bytes before the next row to read
+  inline uint64_t offset() const { return start_ + reader_->position(); }
+  // Rows read, without the header
+  inline size_t rows() const { return rows_; }
+  // Empty until the header is read
+  inline const std::vector<std::string>& header() const { return header_; }
+
+  // Streams the rows appended since the last poll, and returns their number. Returns 0 if the file
+  // doesn't exist yet, throws if it is shorter than what was read.
+  size_t poll(std::function<void(const std::vector<std::string>&)> parse_func) {
+    if (!open() || !readHeader()) {
+      return 0;
+    }
+    size_t count = 0;
+    while (reader_->readRow(row_)) {
+      rows_++;
+      count++;
+      parse_func(row_);
     }
+    return count;
   }
 
-  using flat::get;
-  template <typename T = std::string>
-  inline T get(size_t row, const std::string& column) const { return mapped_row(header_, data_.at(row)).get<T>(column); }
+  size_t poll(std::function<void(const mapped_row&)> parse_func) {
+    if (!has_header_) {
+      throw std::runtime_error("Following rows by column name needs a header");
+    }
+    if (!open() || !readHeader()) {
+      return 0;
+    }
+    size_t count = 0;
+    while (reader_->readRow(row_, header_.size())) {
+      rows_++;
+      count++;
+      parse_func(mapped_row(header_, index_, row_));
+    }
+    return count;
+  }
+
+  // Saves the position in a binary format, in the byte order of this machine
+  void write(std::ostream& out) const {
+    if (out.bad() || out.fail()) {
+      throw std::runtime_error("Bad output");
+    }
+    uint64_t info[5] = {magic(), offset(), rows_, has_header_ ? 1u : 0u, header_.size()};
+    out.write(reinterpret_cast<const char*>(info), sizeof(info));
+    for (const auto& column : header_) {
+      uint64_t size = column.size();
+      out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+      out.write(column.data(), column.size());
+    }
+    if (out.bad() || out.fail()) {
+      throw std::runtime_error("Bad output");
+    }
+  }
+
+  void write(const std::string& filename) const {
+    std::ofstream out(filename, std::ios::out | std::ios::binary);
+    write(out);
+  }
+
+  // Continues from a position saved by write, for the same file
+  void read(std::istream& in) {
+    if (in.bad() || in.fail()) {
+      throw std::runtime_error("Bad input");
+    }
+    uint64_t info[5];
+    if (!in.read(reinterpret_cast<char*>(info), sizeof(info)) || info[0] != magic() || info[3] != (has_header_ ? 1u : 0u)) {
+      throw std::runtime_error("Bad follower position");
+    }
+    std::vector<std::string> header(info[4]);
+    for (auto& column : header) {
+      uint64_t size;
+      if (!in.read(reinterpret_cast<char*>(&size), sizeof(size))) {
+        throw std::runtime_error("Bad follower position");
+      }
+      column.resize(size);
+      if (!in.read(&column[0], size)) {
+        throw std::runtime_error("Bad follower position");
+      }
+    }
+    header_ = std::move(header);
+    index_.assign(header_);
+    rows_ = info[2];
+    reset(info[1]);
+  }
 
-  bool operator==(const mapped& other) const { return header_ == other.header_ && flat::operator==(other); }
-  bool operator!=(const mapped& other) const { return !(*this == other); }
+  void read(const std::string& filename) {
+    std::ifstream in(filename, std::ios::in | std::ios::binary);
+    read(in);
+  }
 
  private:
+  static uint64_t magic() { return 0x316c667673634870ull; }  // "pHcsvfl1"
+
+  // Starts reading at offset, with a new reader
+  void reset(uint64_t offset) {
+    start_ = offset;
+    read_ = offset;
+    reader_.reset(new detail::block_reader([this] (char* buffer, size_t size) {
+      size_t count = static_cast<size_t>(in_.rdbuf()->sgetn(buffer, size));
+      read_ += count;
+      return count;
+    }, 1 << 16, true));
+  }
+
+  // Opens the file again, so a file replaced by a shorter one is detected, and positions it after
+  // the bytes already read
+  bool open() {
+    in_.close();
+    in_.clear();
+    in_.open(filename_, std::ios::in | std::ios::binary);
+    if (!in_.is_open()) {
+      return false;
+    }
+    std::streampos end = in_.rdbuf()->pubseekoff(0, std::ios::end, std::ios::in);
+    if (end == std::streampos(-1)) {
+      throw std::runtime_error("Bad input");
+    }
+    if (static_cast<uint64_t>(end) < read_) {
+      throw std::runtime_error("File " + filename_ + " is shorter than what was read");
+    }
+    in_.rdbuf()->pubseekpos(static_cast<std::streamoff>(read_), std::ios::in);
+    return true;
+  }
+
+  // Returns false while the header isn't complete
+  bool readHeader() {
+    if (!has_header_ || !header_.empty()) {
+      return true;
+    }
+    if (!reader_->readRow(header_)) {
+      return false;
+    }
+    index_.assign(header_);
+    return true;
+  }
+
+  std::string filename_;
+  bool has_header_;
   std::vector<std::string> header_;
+  detail::header_map index_;
+  size_t rows_;
+  uint64_t start_;  // offset of the first row read by reader_
+  uint64_t read_;  // offset after the bytes read from the file
+  std::ifstream in_;
+  std::unique_ptr<detail::block_reader> reader_;
+  std::vector<std::string> row_;
 };
 
-void streamRows(std::istream& in, std::function<void(const mapped_row&)> parse_func) {
-  if (in.bad() || in.fail()) {
-    throw std::runtime_error("Bad input");
+// Parses input pushed in buffers of any size, for example from a socket, and passes each complete
+// row to parse_func as views. Fields are views into the buffer given to feed, so they are not
+// copied, except for fields with escaped quotes, which are unescaped, and rows split across
+// buffers, which are kept until the buffer completing them. Views are only valid during the call
+// to parse_func.
+template <typename Dialect = csv_dialect>
+class basic_push_parser {
+ public:
+  explicit basic_push_parser(std::function<void(const std::vector<view>&)> parse_func)
+    : parse_func_(std::move(parse_func)), partial_(), state_(scan_state::field_start), quotes_(0), carriage_return_(false), fields_(), row_(), unescaped_(), rows_(0) {}
+
+  // Parses the rows completed by data
+  void feed(const char* data, size_t size) {
+    const char* begin = data;
+    const char* end = data + size;
+    if (!partial_.empty()) {
+      // Only copies the rest of the partial row. The scan resumes where the previous feed stopped,
+      // so a row split across many buffers is scanned once.
+      const char* row_end = scanRow(begin, end);
+      if (row_end == nullptr) {
+        partial_.append(begin, end);
+        return;
+      }
+      partial_.append(begin, row_end);
+      begin = row_end;
+      detail::basic_tokenizer<Dialect> tokens(partial_.data(), partial_.data() + partial_.size(), false);
+      parseRow(tokens, false);
+      partial_.clear();
+    }
+    detail::basic_tokenizer<Dialect> tokens(begin, end, false);
+    while (!tokens.done()) {
+      const char* row_begin = tokens.position();
+      if (!parseRow(tokens, false)) {
+        partial_.assign(row_begin, end);
+        scanRow(row_begin, end);
+        return;
+      }
+    }
+  }
+
+  inline void feed(const std::string& data) { feed(data.data(), data.size()); }
+
+  // Parses the last row, which doesn't need to end with a newline. The parser can then be fed
+  // another input.
+  void finish() {
+    if (partial_.empty()) {
+      return;
+    }
+    detail::basic_tokenizer<Dialect> tokens(partial_.data(), partial_.data() + partial_.size(), true);
+    while (!tokens.done()) {
+      parseRow(tokens, true);
+    }
+    partial_.clear();
+    state_ = scan_state::field_start;
+    quotes_ = 0;
+    carriage_return_ = false;
+  }
+
+  // Number of rows passed to parse_func
+  inline size_t rows() const { return rows_; }
+
+ private:
+  // Passes the next row to parse_func, or returns false without moving if it is incomplete
+  bool parseRow(detail::basic_tokenizer<Dialect>& tokens, bool eof) {
+    fields_.clear();
+    bool new_row = false;
+    detail::raw_field field;
+    while (!tokens.done() && !new_row) {
+      if (!tokens.next(field, new_row)) {
+        return false;
+      }
+      fields_.push_back(field);
+    }
+    if (!new_row && !eof) {
+      return false;
+    }
+    if (unescaped_.size() < fields_.size()) {
+      unescaped_.resize(fields_.size());
+    }
+    row_.clear();
+    for (size_t i = 0; i < fields_.size(); i++) {
+      if (fields_[i].escaped) {
+        detail::unescapeCsvField<Dialect>(fields_[i], unescaped_[i]);
+        row_.emplace_back(unescaped_[i]);
+      } else {
+        row_.emplace_back(fields_[i].begin, fields_[i].end - fields_[i].begin);
+      }
+    }
+    rows_++;
+    parse_func_(row_);
+    return true;
   }
-  std::istreambuf_iterator<char> it(in);
-  std::vector<std::string> header = detail::readCsvRow(it);
-  while (it != detail::EOCSVF) {
-    parse_func(mapped_row(header, detail::readCsvRow(it, header.size())));
+
+  enum class scan_state { field_start, unquoted, quoted };
+
+  // Continues the scan of the partial row with the rules of basic_tokenizer, and returns the end of
+  // the newline that completes it, or nullptr if the row continues past end
+  const char* scanRow(const char* begin, const char* end) {
+    for (const char* pos = begin; pos != end; pos++) {
+      char c = *pos;
+      if (state_ == scan_state::field_start) {
+        if (c == Dialect::quote) {
+          state_ = scan_state::quoted;
+          quotes_ = 0;
+          carriage_return_ = false;
+          continue;
+        }
+        state_ = scan_state::unquoted;
+      }
+      if (state_ == scan_state::unquoted) {
+        if (c == '\n') {
+          state_ = scan_state::field_start;
+          return pos + 1;
+        }
+        if (c == Dialect::separator) {
+          state_ = scan_state::field_start;
+        }
+        continue;
+      }
+      // An odd number of quotes before a separator closes a quoted field. With crlf, the quotes
+      // can also be followed by the '\r' of a line ending.
+      bool closed = quotes_ % 2 == 1;
+      if (c == '\n' && closed) {
+        state_ = scan_state::field_start;
+        return pos + 1;
+      }
+      if (c == Dialect::separator && closed && !carriage_return_) {
+        state_ = scan_state::field_start;
+      } else if (c == Dialect::quote) {
+        quotes_ = carriage_return_ ? 1 : quotes_ + 1;
+        carriage_return_ = false;
+      } else if (Dialect::crlf && c == '\r' && !carriage_return_) {
+        carriage_return_ = true;
+      } else {
+        quotes_ = 0;
+        carriage_return_ = false;
+      }
+    }
+    return nullptr;
   }
+
+  std::function<void(const std::vector<view>&)> parse_func_;
+  std::string partial_;  // start of a row split across buffers
+  scan_state state_;  // of the scan of partial_, at its end
+  size_t quotes_;  // quotes at the end of a quoted field, before a '\r' if carriage_return_
+  bool carriage_return_;  // the quoted field ends with '\r' after the quotes
+  std::vector<detail::raw_field> fields_;
+  std::vector<view> row_;
+  std::vector<std::string> unescaped_;
+  size_t rows_;
+};
+
+typedef basic_push_parser<> push_parser;
+
+// Binds a CSV column, by header name or by index, to a member of Struct. Empty fields are
+// parsed like any other field unless an empty value is given.
+template <typename Struct, typename T>
+struct column_binding {
+  column_binding(std::string name, T Struct::* member)
+    : name(std::move(name)), index(0), member(member), has_empty_value(false), empty_value() {}
+  column_binding(size_t index, T Struct::* member)
+    : name(), index(index), member(member), has_empty_value(false), empty_value() {}
+  column_binding(std::string name, T Struct::* member, T empty_value)
+    : name(std::move(name)), index(0), member(member), has_empty_value(true), empty_value(std::move(empty_value)) {}
+  column_binding(size_t index, T Struct::* member, T empty_value)
+    : name(), index(index), member(member), has_empty_value(true), empty_value(std::move(empty_value)) {}
+
+  std::string name;
+  size_t index;
+  T Struct::* member;
+  bool has_empty_value;
+  T empty_value;
+};
+
+template <typename Struct, typename T>
+inline column_binding<Struct, T> column(std::string name, T Struct::* member) {
+  return column_binding<Struct, T>(std::move(name), member);
 }
 
-inline void streamRows(const std::string& filename, std::function<void(const mapped_row&)> parse_func) {
-  std::ifstream in(filename, std::ios::in | std::ios::binary);
-  streamRows(in, parse_func);
+template <typename Struct, typename T>
+inline column_binding<Struct, T> column(size_t index, T Struct::* member) {
+  return column_binding<Struct, T>(index, member);
+}
+
+template <typename Struct, typename T, typename U>
+inline column_binding<Struct, T> column(std::string name, T Struct::* member, U empty_value) {
+  return column_binding<Struct, T>(std::move(name), member, T(std::move(empty_value)));
+}
+
+template <typename Struct, typename T, typename U>
+inline column_binding<Struct, T> column(size_t index, T Struct::* member, U empty_value) {
+  return column_binding<Struct, T>(index, member, T(std::move(empty_value)));
+}
+
+// Compile time mapping from CSV columns to members of Struct, used by streamRows to parse
+// fields directly into typed members. If any column is bound by name the CSV must have a header.
+// A header is skipped by default only if a column is bound by name.
+template <typename Struct, typename... Members>
+class schema {
+ public:
+  schema(column_binding<Struct, Members>... bindings) : bindings_(std::move(bindings)...) {}
+
+  // True if any column is bound by name
+  inline bool hasHeader() const { return hasHeader(std::integral_constant<size_t, 0>()); }
+
+  // Reads the header, if the input has one, and resolves the column index of every binding
+  void resolve(detail::block_reader& reader, std::vector<size_t>& indices, bool has_header) const {
+    std::vector<std::string> header;
+    if (!has_header && hasHeader()) {
+      throw std::runtime_error("Column names can only be bound with a header");
+    }
+    if (has_header && !reader.readRow(header)) {
+      throw std::runtime_error("Missing header");
+    }
+    indices.clear();
+    resolve(header, indices, std::integral_constant<size_t, 0>());
+  }
+
+  inline void parse(const std::vector<detail::raw_field>& fields, const std::vector<size_t>& indices, Struct& result, std::string& scratch) const {
+    parse(fields, indices, result, scratch, std::integral_constant<size_t, 0>());
+  }
+
+ private:
+  static constexpr size_t size = sizeof...(Members);
+  typedef std::integral_constant<size_t, size> end_tag;
+
+  inline bool hasHeader(end_tag) const { return false; }
+
+  template <size_t I>
+  inline bool hasHeader(std::integral_constant<size_t, I>) const {
+    return !std::get<I>(bindings_).name.empty() || hasHeader(std::integral_constant<size_t, I + 1>());
+  }
+
+  inline void resolve(const std::vector<std::string>&, std::vector<size_t>&, end_tag) const {}
+
+  template <size_t I>
+  inline void resolve(const std::vector<std::string>& header, std::vector<size_t>& indices, std::integral_constant<size_t, I>) const {
+    const auto& binding = std::get<I>(bindings_);
+    indices.push_back(binding.name.empty() ? binding.index : detail::headerIndex(header, binding.name));
+    resolve(header, indices, std::integral_constant<size_t, I + 1>());
+  }
+
+  inline void parse(const std::vector<detail::raw_field>&, const std::vector<size_t>&, Struct&, std::string&, end_tag) const {}
+
+  template <size_t I>
+  inline void parse(const std::vector<detail::raw_field>& fields, const std::vector<size_t>& indices, Struct& result, std::string& scratch, std::integral_constant<size_t, I>) const {
+    const auto& binding = std::get<I>(bindings_);
+    const detail::raw_field& field = indices[I] < fields.size() ? fields[indices[I]] : detail::missingField();
+    if (binding.has_empty_value && field.begin == field.end) {
+      result.*binding.member = binding.empty_value;
+    } else {
+      detail::parseField(field, result.*binding.member, scratch);
+    }
+    parse(fields, indices, result, scratch, std::integral_constant<size_t, I + 1>());
+  }
+
+  std::tuple<column_binding<Struct, Members>...> bindings_;
+};
+
+template <typename Struct, typename... Members>
+inline schema<Struct, Members...> makeSchema(column_binding<Struct, Members>... bindings) {
+  return schema<Struct, Members...>(std::move(bindings)...);
 }
 
-void streamRows(std::istream& in, std::function<void(const std::vector<std::string>&)> parse_func) {
+// Parses every row directly into a Struct, which is passed as an rvalue to parse_func. The header
+// is skipped if has_header, which is needed when all columns are bound by index.
+template <typename Struct, typename... Members, typename ParseFunc>
+inline void streamRows(std::istream& in, const schema<Struct, Members...>& row_schema, bool has_header, ParseFunc parse_func) {
   if (in.bad() || in.fail()) {
     throw std::runtime_error("Bad input");
   }
-  std::istreambuf_iterator<char> it(in);
-  while (it != detail::EOCSVF) {
-    parse_func(detail::readCsvRow(it));
+  detail::block_reader reader(in);
+  std::vector<size_t> indices;
+  row_schema.resolve(reader, indices, has_header);
+  std::vector<detail::raw_field> fields;
+  std::string scratch;
+  while (reader.readFields(fields)) {
+    Struct result;
+    row_schema.parse(fields, indices, result, scratch);
+    parse_func(std::move(result));
   }
 }
 
-inline void streamRows(const std::string& filename, std::function<void(const std::vector<std::string>&)> parse_func) {
+template <typename Struct, typename... Members, typename ParseFunc>
+inline void streamRows(const std::string& filename, const schema<Struct, Members...>& row_schema, bool has_header, ParseFunc parse_func) {
   std::ifstream in(filename, std::ios::in | std::ios::binary);
-  streamRows(in, parse_func);
+  streamRows(in, row_schema, has_header, parse_func);
+}
+
+// As above, with a header only if a column is bound by name
+template <typename Struct, typename... Members, typename ParseFunc>
+inline void streamRows(std::istream& in, const schema<Struct, Members...>& row_schema, ParseFunc parse_func) {
+  streamRows(in, row_schema, row_schema.hasHeader(), parse_func);
+}
+
+template <typename Struct, typename... Members, typename ParseFunc>
+inline void streamRows(const std::string& filename, const schema<Struct, Members...>& row_schema, ParseFunc parse_func) {
+  streamRows(filename, row_schema, row_schema.hasHeader(), parse_func);
 }
 
 }  // namespace csv
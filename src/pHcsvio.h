@@ -0,0 +1,775 @@
+#pragma once
+
+#include "pHcsv.h"
+
+#include <deque>
+#include <memory>
+#include <istream>
+#include <streambuf>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace pH {
+
+namespace csv {
+
+namespace detail {
+
+class mmap_file {
+ public:
+  explicit mmap_file(const std::string& filename, int advice = MADV_SEQUENTIAL) : data_(nullptr), size_(0) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("Bad input");
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      ::close(fd);
+      throw std::runtime_error("Bad input");
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ > 0) {
+      void* data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED) {
+        ::close(fd);
+        throw std::runtime_error("Unable to memory map " + filename);
+      }
+      ::madvise(data, size_, advice);
+      data_ = static_cast<const char*>(data);
+    }
+    ::close(fd);
+  }
+
+  mmap_file(const mmap_file& other) = delete;
+  mmap_file& operator=(const mmap_file& other) = delete;
+
+  ~mmap_file() {
+    if (data_ != nullptr) {
+      ::munmap(const_cast<char*>(data_), size_);
+    }
+  }
+
+  inline const char* data() const { return data_; }
+  inline size_t size() const { return size_; }
+
+ private:
+  const char* data_;
+  size_t size_;
+};
+
+class fd_streambuf : public std::streambuf {
+ public:
+  explicit fd_streambuf(int fd) : fd_(fd) {}
+
+ protected:
+  int_type underflow() override {
+    if (gptr() == egptr()) {
+      size_t read = readSome(buffer_, sizeof(buffer_));
+      if (read == 0) {
+        return traits_type::eof();
+      }
+      setg(buffer_, buffer_, buffer_ + read);
+    }
+    return traits_type::to_int_type(*gptr());
+  }
+
+  // Large reads, like the blocks of block_reader, go directly to the caller's buffer
+  std::streamsize xsgetn(char* data, std::streamsize size) override {
+    std::streamsize copied = std::min<std::streamsize>(size, egptr() - gptr());
+    if (copied > 0) {
+      std::memcpy(data, gptr(), copied);
+      gbump(static_cast<int>(copied));
+    }
+    while (copied < size) {
+      size_t read = readSome(data + copied, static_cast<size_t>(size - copied));
+      if (read == 0) {
+        break;
+      }
+      copied += read;
+    }
+    return copied;
+  }
+
+ private:
+  size_t readSome(char* data, size_t size) {
+    ssize_t read;
+    do {
+      read = ::read(fd_, data, size);
+    } while (read < 0 && errno == EINTR);
+    if (read < 0) {
+      throw std::runtime_error("Bad input");
+    }
+    return static_cast<size_t>(read);
+  }
+
+  int fd_;
+  char buffer_[1 << 12];
+};
+
+// Reads one row of views from a tokenizer over a complete buffer. Fields containing escaped quotes
+// are unescaped into strings provided by the store functor, all other fields point into the buffer.
+template <typename Store>
+inline void readViewRow(tokenizer& tokens, std::vector<view>& row, Store store) {
+  bool new_row = false;
+  raw_field field;
+  while (!tokens.done() && !new_row) {
+    tokens.next(field, new_row);
+    if (field.escaped) {
+      std::string& unescaped = store(row.size());
+      unescapeCsvField(field, unescaped);
+      row.emplace_back(unescaped);
+    } else {
+      row.emplace_back(field.begin, field.end - field.begin);
+    }
+  }
+}
+
+}  // namespace detail
+
+// std::istream reading from a file descriptor, such as a pipe or STDIN_FILENO, to use it with
+// any reader taking a std::istream. The file descriptor is not closed.
+class fd_istream : public std::istream {
+ public:
+  explicit fd_istream(int fd) : std::istream(nullptr), buffer_(fd) {
+    rdbuf(&buffer_);
+  }
+
+ private:
+  detail::fd_streambuf buffer_;
+};
+
+// Read only equivalent of pH::csv::flat, where fields are views into a memory mapped file
+class flat_view {
+ public:
+  flat_view() : file_(), fields_(), rows_(1, 0), unescaped_(), columns_(0) {}
+
+  flat_view(const std::string& filename) : flat_view() {
+    file_.reset(new detail::mmap_file(filename));
+    detail::tokenizer tokens(file_->data(), file_->data() + file_->size(), true);
+    read(tokens, 0);
+  }
+
+  // Buffer must outlive the flat_view
+  flat_view(const char* data, size_t size) : flat_view() {
+    detail::tokenizer tokens(data, data + size, true);
+    read(tokens, 0);
+  }
+
+  flat_view(flat_view&& other) = default;
+  flat_view& operator=(flat_view&& other) = default;
+
+  inline size_t rows() const { return rows_.size() - 1; }
+  virtual inline size_t columns() const { return columns_; }
+  inline size_t columns(size_t row) const { return rows_.at(row + 1) - rows_[row]; }
+
+  inline view at(size_t row, size_t column) const {
+    if (column >= columns(row)) {
+      throw std::out_of_range("Column " + std::to_string(column) + " out of bounds");
+    }
+    return fields_[rows_[row] + column];
+  }
+
+  template <typename T = std::string>
+  inline T get(size_t row, size_t column) const {
+    return detail::convert<T>(at(row, column));
+  }
+
+  template <typename T>
+  inline T get(size_t row, size_t column, const T& empty_value) const {
+    return detail::convert<T>(at(row, column), empty_value);
+  }
+
+  template <typename T = std::string>
+  std::vector<T> getColumn(size_t column) const {
+    std::vector<T> result;
+    result.reserve(rows());
+    for (size_t row = 0; row < rows(); row++) {
+      result.push_back(detail::convert<T>(at(row, column)));
+    }
+    return result;
+  }
+
+  template <typename T>
+  std::vector<T> getColumn(size_t column, const T& empty_value) const {
+    std::vector<T> result;
+    result.reserve(rows());
+    for (size_t row = 0; row < rows(); row++) {
+      result.push_back(detail::convert<T>(at(row, column), empty_value));
+    }
+    return result;
+  }
+
+  virtual ~flat_view() = default;
+
+ protected:
+  // Pads all rows to at least min_columns fields
+  void read(detail::tokenizer& tokens, size_t min_columns) {
+    std::vector<view> row;
+    while (!tokens.done()) {
+      row.clear();
+      readRow(tokens, row);
+      for (size_t i = row.size(); i < min_columns; i++) {
+        row.emplace_back();
+      }
+      fields_.insert(fields_.end(), row.begin(), row.end());
+      rows_.push_back(fields_.size());
+      columns_ = std::max(columns_, row.size());
+    }
+  }
+
+  void readRow(detail::tokenizer& tokens, std::vector<view>& row) {
+    detail::readViewRow(tokens, row, [this] (size_t) -> std::string& {
+      unescaped_.emplace_back();
+      return unescaped_.back();
+    });
+  }
+
+  std::unique_ptr<detail::mmap_file> file_;
+  std::vector<view> fields_;
+  std::vector<size_t> rows_;  // rows_[i] is the index in fields_ of the first field in row i
+  std::deque<std::string> unescaped_;  // deque to keep views of unescaped fields valid
+
+ private:
+  size_t columns_;
+};
+
+class mapped_view_row {
+ public:
+  mapped_view_row(const std::vector<std::string>& header, const std::vector<view>& data) : header_(header), index_(nullptr), data_(data) {}
+  mapped_view_row(const std::vector<std::string>& header, const detail::header_map& index, const std::vector<view>& data)
+    : header_(header), index_(&index), data_(data) {}
+  mapped_view_row() = delete;
+  mapped_view_row(const mapped_view_row& other) = delete;
+  mapped_view_row(mapped_view_row&& other) = delete;
+  mapped_view_row& operator=(const mapped_view_row& other) = delete;
+  mapped_view_row& operator=(mapped_view_row&& other) = delete;
+
+  inline size_t size() const { return data_.size(); }
+
+  inline column_handle column(const std::string& column) const { return column_handle(headerIndex(column)); }
+
+  inline view at(const std::string& column) const {
+    return data_[headerIndex(column)];
+  }
+
+  inline view at(size_t column) const {
+    if (column >= data_.size()) {
+      throw std::runtime_error("Column " + std::to_string(column) + " out of bounds");
+    }
+    return data_[column];
+  }
+
+  inline view at(column_handle column) const { return at(column.index()); }
+
+  template <typename T = std::string>
+  inline T get(const std::string& column) const { return detail::convert<T>(at(column)); }
+  template <typename T = std::string>
+  inline T get(size_t column) const { return detail::convert<T>(at(column)); }
+  template <typename T>
+  inline T get(const std::string& column, const T& empty_value) const { return detail::convert<T>(at(column), empty_value); }
+  template <typename T>
+  inline T get(size_t column, const T& empty_value) const { return detail::convert<T>(at(column), empty_value); }
+  template <typename T = std::string>
+  inline T get(column_handle column) const { return detail::convert<T>(at(column)); }
+  template <typename T>
+  inline T get(column_handle column, const T& empty_value) const { return detail::convert<T>(at(column), empty_value); }
+
+ private:
+  inline size_t headerIndex(const std::string& column) const {
+    return index_ != nullptr ? index_->at(column) : detail::headerIndex(header_, column);
+  }
+
+  const std::vector<std::string>& header_;
+  const detail::header_map* index_;  // linear search in header_ if null
+  const std::vector<view>& data_;
+};
+
+// Read only equivalent of pH::csv::mapped, where fields are views into a memory mapped file
+class mapped_view : public flat_view {
+ public:
+  mapped_view(const std::string& filename) : flat_view(), header_(), index_() {
+    file_.reset(new detail::mmap_file(filename));
+    read(file_->data(), file_->size());
+  }
+
+  // Buffer must outlive the mapped_view
+  mapped_view(const char* data, size_t size) : flat_view(), header_(), index_() {
+    read(data, size);
+  }
+
+  mapped_view(mapped_view&& other) = default;
+  mapped_view& operator=(mapped_view&& other) = default;
+
+  inline const std::vector<std::string>& header() const { return header_; }
+
+  inline size_t headerIndex(const std::string& column) const {
+    return index_.at(column);
+  }
+
+  using flat_view::at;
+  inline view at(size_t row, const std::string& column) const { return at(row, headerIndex(column)); }
+
+  using flat_view::get;
+  template <typename T = std::string>
+  inline T get(size_t row, const std::string& column) const { return detail::convert<T>(at(row, column)); }
+  template <typename T>
+  inline T get(size_t row, const std::string& column, const T& empty_value) const { return detail::convert<T>(at(row, column), empty_value); }
+
+  using flat_view::getColumn;
+  template <typename T = std::string>
+  inline std::vector<T> getColumn(const std::string& column) const { return flat_view::getColumn<T>(headerIndex(column)); }
+  template <typename T>
+  inline std::vector<T> getColumn(const std::string& column, const T& empty_value) const { return flat_view::getColumn<T>(headerIndex(column), empty_value); }
+
+  inline size_t columns() const override { return header_.size(); }
+
+ private:
+  void read(const char* data, size_t size) {
+    detail::tokenizer tokens(data, data + size, true);
+    std::vector<view> header;
+    readRow(tokens, header);
+    for (const view& column : header) {
+      header_.push_back(column.str());
+    }
+    index_.assign(header_);
+    flat_view::read(tokens, header_.size());
+  }
+
+  std::vector<std::string> header_;
+  detail::header_map index_;
+};
+
+// Streams rows from a memory mapped file, views are only valid during the call to parse_func
+inline void streamRows(const std::string& filename, std::function<void(const mapped_view_row&)> parse_func) {
+  detail::mmap_file file(filename);
+  detail::tokenizer tokens(file.data(), file.data() + file.size(), true);
+  std::deque<std::string> unescaped;  // deque to keep views valid when growing
+  auto store = [&unescaped] (size_t column) -> std::string& {
+    if (column >= unescaped.size()) {
+      unescaped.resize(column + 1);
+    }
+    return unescaped[column];
+  };
+  std::vector<view> row;
+  detail::readViewRow(tokens, row, store);
+  std::vector<std::string> header;
+  for (const view& column : row) {
+    header.push_back(column.str());
+  }
+  detail::header_map index(header);
+  while (!tokens.done()) {
+    row.clear();
+    detail::readViewRow(tokens, row, store);
+    row.resize(std::max(row.size(), header.size()));
+    parse_func(mapped_view_row(header, index, row));
+  }
+}
+
+inline void streamRows(const std::string& filename, std::function<void(const std::vector<view>&)> parse_func) {
+  detail::mmap_file file(filename);
+  detail::tokenizer tokens(file.data(), file.data() + file.size(), true);
+  std::deque<std::string> unescaped;  // deque to keep views valid when growing
+  auto store = [&unescaped] (size_t column) -> std::string& {
+    if (column >= unescaped.size()) {
+      unescaped.resize(column + 1);
+    }
+    return unescaped[column];
+  };
+  std::vector<view> row;
+  while (!tokens.done()) {
+    row.clear();
+    detail::readViewRow(tokens, row, store);
+    parse_func(row);
+  }
+}
+
+namespace detail {
+
+// Layout of a snapshot file: this header, rows + 1 offsets of the first field of each row, fields + 1
+// offsets of each field in the data, then the unescaped fields. The size and modification time of
+// the source file are recorded to detect stale snapshots.
+struct snapshot_header {
+  char magic[8];
+  uint64_t byte_order;
+  uint64_t source_size;
+  int64_t source_mtime_sec;
+  int64_t source_mtime_nsec;
+  uint64_t has_header;
+  uint64_t rows;  // including the header
+  uint64_t fields;
+  uint64_t columns;
+  uint64_t bytes;
+};
+
+const char snapshot_magic[8] = {'p', 'H', 'c', 's', 'v', 's', 'n', '1'};
+const uint64_t snapshot_byte_order = 0x0102030405060708ull;
+
+struct file_status {
+  uint64_t size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+};
+
+inline bool fileStatus(const std::string& filename, file_status& status) {
+  struct stat st;
+  if (::stat(filename.c_str(), &st) != 0) {
+    return false;
+  }
+  status.size = static_cast<uint64_t>(st.st_size);
+#ifdef __APPLE__
+  status.mtime_sec = st.st_mtimespec.tv_sec;
+  status.mtime_nsec = st.st_mtimespec.tv_nsec;
+#else
+  status.mtime_sec = st.st_mtim.tv_sec;
+  status.mtime_nsec = st.st_mtim.tv_nsec;
+#endif
+  return true;
+}
+
+// Creates a uniquely named empty file next to filename, so processes writing the same snapshot
+// never share a temporary file
+inline std::string createTemporary(const std::string& filename) {
+  std::vector<char> name(filename.begin(), filename.end());
+  const char suffix[] = ".XXXXXX";
+  name.insert(name.end(), suffix, suffix + sizeof(suffix));
+  int fd = ::mkstemp(name.data());
+  if (fd < 0) {
+    throw std::runtime_error("Bad output");
+  }
+  ::fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);  // mkstemp only allows the owner to read
+  ::close(fd);
+  return std::string(name.data());
+}
+
+// Writes to a temporary file renamed at the end, so readers never see a partial snapshot
+inline void writeSnapshot(const flat& data, const std::vector<std::string>* header, const file_status& source, const std::string& filename) {
+  snapshot_header info;
+  std::memcpy(info.magic, snapshot_magic, sizeof(info.magic));
+  info.byte_order = snapshot_byte_order;
+  info.source_size = source.size;
+  info.source_mtime_sec = source.mtime_sec;
+  info.source_mtime_nsec = source.mtime_nsec;
+  info.has_header = header != nullptr ? 1 : 0;
+  info.rows = data.rows() + info.has_header;
+  info.columns = data.columns();
+
+  std::vector<uint64_t> row_offsets(1, 0);
+  std::vector<uint64_t> field_offsets(1, 0);
+  row_offsets.reserve(info.rows + 1);
+  if (header != nullptr) {
+    for (const std::string& field : *header) {
+      field_offsets.push_back(field_offsets.back() + field.size());
+    }
+    row_offsets.push_back(field_offsets.size() - 1);
+  }
+  for (size_t row = 0; row < data.rows(); row++) {
+    for (size_t column = 0; column < data.columns(row); column++) {
+      field_offsets.push_back(field_offsets.back() + data.at(row, column).size());
+    }
+    row_offsets.push_back(field_offsets.size() - 1);
+  }
+  info.fields = field_offsets.size() - 1;
+  info.bytes = field_offsets.back();
+
+  std::string temporary = createTemporary(filename);
+  {
+    std::ofstream out(temporary, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (out.fail()) {
+      std::remove(temporary.c_str());
+      throw std::runtime_error("Bad output");
+    }
+    out.write(reinterpret_cast<const char*>(&info), sizeof(info));
+    out.write(reinterpret_cast<const char*>(row_offsets.data()), row_offsets.size() * sizeof(uint64_t));
+    out.write(reinterpret_cast<const char*>(field_offsets.data()), field_offsets.size() * sizeof(uint64_t));
+    if (header != nullptr) {
+      for (const std::string& field : *header) {
+        out.write(field.data(), field.size());
+      }
+    }
+    for (size_t row = 0; row < data.rows(); row++) {
+      for (size_t column = 0; column < data.columns(row); column++) {
+        const std::string& field = data.at(row, column);
+        out.write(field.data(), field.size());
+      }
+    }
+    out.close();
+    if (out.fail()) {
+      std::remove(temporary.c_str());
+      throw std::runtime_error("Bad output");
+    }
+  }
+  if (std::rename(temporary.c_str(), filename.c_str()) != 0) {
+    std::remove(temporary.c_str());
+    throw std::runtime_error("Bad output");
+  }
+}
+
+}  // namespace detail
+
+// Default location of the snapshot of a CSV file, next to it
+inline std::string snapshotFilename(const std::string& filename) {
+  return filename + ".snapshot";
+}
+
+// Saves data, parsed from source_filename, as a binary snapshot that can be memory mapped by
+// pH::csv::flat_snapshot. The snapshot records the current size and modification time of the source.
+inline void writeSnapshot(const flat& data, const std::string& source_filename, const std::string& snapshot_filename) {
+  detail::file_status source;
+  if (!detail::fileStatus(source_filename, source)) {
+    throw std::runtime_error("Bad input");
+  }
+  detail::writeSnapshot(data, nullptr, source, snapshot_filename);
+}
+
+inline void writeSnapshot(const flat& data, const std::string& source_filename) {
+  writeSnapshot(data, source_filename, snapshotFilename(source_filename));
+}
+
+// Also saves the header, for pH::csv::mapped_snapshot
+inline void writeSnapshot(const mapped& data, const std::string& source_filename, const std::string& snapshot_filename) {
+  detail::file_status source;
+  if (!detail::fileStatus(source_filename, source)) {
+    throw std::runtime_error("Bad input");
+  }
+  detail::writeSnapshot(data, &data.header(), source, snapshot_filename);
+}
+
+inline void writeSnapshot(const mapped& data, const std::string& source_filename) {
+  writeSnapshot(data, source_filename, snapshotFilename(source_filename));
+}
+
+// True if snapshot_filename exists and was written for the current size and modification time of
+// source_filename
+inline bool validSnapshot(const std::string& source_filename, const std::string& snapshot_filename) {
+  detail::file_status source;
+  if (!detail::fileStatus(source_filename, source)) {
+    return false;
+  }
+  std::ifstream in(snapshot_filename, std::ios::in | std::ios::binary);
+  detail::snapshot_header info;
+  if (!in.read(reinterpret_cast<char*>(&info), sizeof(info))) {
+    return false;
+  }
+  return std::memcmp(info.magic, detail::snapshot_magic, sizeof(info.magic)) == 0 && info.byte_order == detail::snapshot_byte_order &&
+         info.source_size == source.size && info.source_mtime_sec == source.mtime_sec && info.source_mtime_nsec == source.mtime_nsec;
+}
+
+inline bool validSnapshot(const std::string& source_filename) {
+  return validSnapshot(source_filename, snapshotFilename(source_filename));
+}
+
+// Read only equivalent of pH::csv::flat backed by a memory mapped snapshot. Opening maps the file
+// and only reads its header, and fields are views into it, so nothing is parsed or copied. Offsets
+// are checked against the size of the snapshot when a row or field is accessed, which throws
+// std::runtime_error for a corrupted snapshot.
+class flat_snapshot {
+ public:
+  flat_snapshot() : file_(), row_offsets_(nullptr), field_offsets_(nullptr), data_(nullptr), fields_(0), bytes_(0), rows_(0), columns_(0), first_row_(0) {}
+
+  // Throws std::runtime_error if snapshot_filename is not a snapshot. Use validSnapshot to check
+  // that it is up to date.
+  explicit flat_snapshot(const std::string& snapshot_filename) : flat_snapshot() {
+    open(snapshot_filename);
+  }
+
+  flat_snapshot(flat_snapshot&& other) = default;
+  flat_snapshot& operator=(flat_snapshot&& other) = default;
+
+  inline size_t rows() const { return rows_ - first_row_; }
+  virtual inline size_t columns() const { return columns_; }
+  inline size_t columns(size_t row) const {
+    if (row >= rows()) {
+      throw std::out_of_range("Row " + std::to_string(row) + " out of bounds");
+    }
+    return rowEnd(first_row_ + row) - row_offsets_[first_row_ + row];
+  }
+
+  inline view at(size_t row, size_t column) const {
+    if (column >= columns(row)) {
+      throw std::out_of_range("Column " + std::to_string(column) + " out of bounds");
+    }
+    return field(row_offsets_[first_row_ + row] + column);
+  }
+
+  template <typename T = std::string>
+  inline T get(size_t row, size_t column) const {
+    return detail::convert<T>(at(row, column));
+  }
+
+  template <typename T>
+  inline T get(size_t row, size_t column, const T& empty_value) const {
+    return detail::convert<T>(at(row, column), empty_value);
+  }
+
+  template <typename T = std::string>
+  std::vector<T> getColumn(size_t column) const {
+    std::vector<T> result;
+    result.reserve(rows());
+    for (size_t row = 0; row < rows(); row++) {
+      result.push_back(detail::convert<T>(at(row, column)));
+    }
+    return result;
+  }
+
+  template <typename T>
+  std::vector<T> getColumn(size_t column, const T& empty_value) const {
+    std::vector<T> result;
+    result.reserve(rows());
+    for (size_t row = 0; row < rows(); row++) {
+      result.push_back(detail::convert<T>(at(row, column), empty_value));
+    }
+    return result;
+  }
+
+  virtual ~flat_snapshot() = default;
+
+ protected:
+  // Returns true if the snapshot has a header
+  bool open(const std::string& snapshot_filename) {
+    file_.reset(new detail::mmap_file(snapshot_filename, MADV_NORMAL));
+    const size_t size = file_->size();
+    detail::snapshot_header info;
+    if (size < sizeof(info)) {
+      throw std::runtime_error("Bad snapshot " + snapshot_filename);
+    }
+    std::memcpy(&info, file_->data(), sizeof(info));
+    const uint64_t max_offsets = (size - sizeof(info)) / sizeof(uint64_t);
+    if (std::memcmp(info.magic, detail::snapshot_magic, sizeof(info.magic)) != 0 || info.byte_order != detail::snapshot_byte_order ||
+        info.rows >= max_offsets || info.fields >= max_offsets - info.rows - 1 ||
+        size - sizeof(info) - (info.rows + info.fields + 2) * sizeof(uint64_t) != info.bytes) {
+      throw std::runtime_error("Bad snapshot " + snapshot_filename);
+    }
+    row_offsets_ = reinterpret_cast<const uint64_t*>(file_->data() + sizeof(info));
+    field_offsets_ = row_offsets_ + info.rows + 1;
+    data_ = reinterpret_cast<const char*>(field_offsets_ + info.fields + 1);
+    fields_ = info.fields;
+    bytes_ = info.bytes;
+    rows_ = info.rows;
+    columns_ = info.columns;
+    return info.has_header != 0;
+  }
+
+  // Offsets of a corrupted snapshot could point outside of it, so each pair is checked when read
+  inline uint64_t rowEnd(size_t row) const {
+    if (row_offsets_[row] > row_offsets_[row + 1] || row_offsets_[row + 1] > fields_) {
+      throw std::runtime_error("Bad snapshot offsets of row " + std::to_string(row));
+    }
+    return row_offsets_[row + 1];
+  }
+
+  inline view field(size_t index) const {
+    if (field_offsets_[index] > field_offsets_[index + 1] || field_offsets_[index + 1] > bytes_) {
+      throw std::runtime_error("Bad snapshot offsets of field " + std::to_string(index));
+    }
+    return view(data_ + field_offsets_[index], field_offsets_[index + 1] - field_offsets_[index]);
+  }
+
+  std::unique_ptr<detail::mmap_file> file_;
+  const uint64_t* row_offsets_;
+  const uint64_t* field_offsets_;
+  const char* data_;
+  uint64_t fields_;
+  uint64_t bytes_;
+  size_t rows_;  // including the header
+  size_t columns_;
+  size_t first_row_;  // 1 to skip the header
+};
+
+// Read only equivalent of pH::csv::mapped backed by a memory mapped snapshot with header
+class mapped_snapshot : public flat_snapshot {
+ public:
+  mapped_snapshot() : flat_snapshot(), header_(), index_() {}
+
+  // Throws std::runtime_error if snapshot_filename is not a snapshot of a pH::csv::mapped
+  explicit mapped_snapshot(const std::string& snapshot_filename) : flat_snapshot(), header_(), index_() {
+    if (!open(snapshot_filename) || rows_ == 0) {
+      throw std::runtime_error("Bad snapshot " + snapshot_filename);
+    }
+    for (size_t column = 0; column < flat_snapshot::columns(0); column++) {
+      header_.push_back(at(0, column).str());
+    }
+    first_row_ = 1;
+    index_.assign(header_);
+  }
+
+  mapped_snapshot(mapped_snapshot&& other) = default;
+  mapped_snapshot& operator=(mapped_snapshot&& other) = default;
+
+  inline const std::vector<std::string>& header() const { return header_; }
+
+  inline size_t headerIndex(const std::string& column) const {
+    return index_.at(column);
+  }
+
+  inline column_handle column(const std::string& column) const { return column_handle(headerIndex(column)); }
+
+  using flat_snapshot::at;
+  inline view at(size_t row, const std::string& column) const { return at(row, headerIndex(column)); }
+  inline view at(size_t row, column_handle column) const { return at(row, column.index()); }
+
+  using flat_snapshot::get;
+  template <typename T = std::string>
+  inline T get(size_t row, const std::string& column) const { return detail::convert<T>(at(row, column)); }
+  template <typename T>
+  inline T get(size_t row, const std::string& column, const T& empty_value) const { return detail::convert<T>(at(row, column), empty_value); }
+  template <typename T = std::string>
+  inline T get(size_t row, column_handle column) const { return detail::convert<T>(at(row, column)); }
+  template <typename T>
+  inline T get(size_t row, column_handle column, const T& empty_value) const { return detail::convert<T>(at(row, column), empty_value); }
+
+  using flat_snapshot::getColumn;
+  template <typename T = std::string>
+  inline std::vector<T> getColumn(const std::string& column) const { return flat_snapshot::getColumn<T>(headerIndex(column)); }
+  template <typename T>
+  inline std::vector<T> getColumn(const std::string& column, const T& empty_value) const { return flat_snapshot::getColumn<T>(headerIndex(column), empty_value); }
+
+  inline size_t columns() const override { return header_.size(); }
+
+ private:
+  std::vector<std::string> header_;
+  detail::header_map index_;
+};
+
+// Maps the snapshot of filename if it is up to date. Otherwise parses filename and writes the
+// snapshot first, so the next call only maps it.
+inline flat_snapshot readFlatCached(const std::string& filename, const std::string& snapshot_filename) {
+  if (!validSnapshot(filename, snapshot_filename)) {
+    // The status from before parsing makes changes during parsing show up as stale next time
+    detail::file_status source;
+    if (!detail::fileStatus(filename, source)) {
+      throw std::runtime_error("Bad input");
+    }
+    detail::writeSnapshot(flat(filename), nullptr, source, snapshot_filename);
+  }
+  return flat_snapshot(snapshot_filename);
+}
+
+inline flat_snapshot readFlatCached(const std::string& filename) {
+  return readFlatCached(filename, snapshotFilename(filename));
+}
+
+inline mapped_snapshot readMappedCached(const std::string& filename, const std::string& snapshot_filename) {
+  if (!validSnapshot(filename, snapshot_filename)) {
+    detail::file_status source;
+    if (!detail::fileStatus(filename, source)) {
+      throw std::runtime_error("Bad input");
+    }
+    mapped data(filename);
+    detail::writeSnapshot(data, &data.header(), source, snapshot_filename);
+  }
+  return mapped_snapshot(snapshot_filename);
+}
+
+inline mapped_snapshot readMappedCached(const std::string& filename) {
+  return readMappedCached(filename, snapshotFilename(filename));
+}
+
+}  // namespace csv
+
+}  // namespace pH
@@ -11,15 +11,16 @@ namespace detail {
 
 class processMapped {
  public:
-    processMapped(const std::vector<std::string>& header, std::vector<std::string>&& row, const std::function<void(const mapped_row&)>& parse_func)
-      : header_(header), row_(std::move(row)), parse_func_(parse_func) {}
+    processMapped(const std::vector<std::string>& header, const header_map& index, std::vector<std::string>&& row, const std::function<void(const mapped_row&)>& parse_func)
+      : header_(header), index_(index), row_(std::move(row)), parse_func_(parse_func) {}
 
-    processMapped(processMapped&& other) noexcept : header_(other.header_), row_(std::move(other.row_)), parse_func_(other.parse_func_) {}
+    processMapped(processMapped&& other) noexcept : header_(other.header_), index_(other.index_), row_(std::move(other.row_)), parse_func_(other.parse_func_) {}
 
-    void operator()() const { parse_func_(mapped_row(header_, row_)); }
+    void operator()() const { parse_func_(mapped_row(header_, index_, row_)); }
 
  private:
   const std::vector<std::string>& header_;
+  const header_map& index_;
   std::vector<std::string> row_;
   const std::function<void(const mapped_row&)>& parse_func_;
 };
@@ -40,7 +41,7 @@ class processFlat {
 
 }
 
-void streamRowsThreaded(std::istream& in, size_t num_threads, std::function<void(const mapped_row&)> parse_func) {
+inline void streamRowsThreaded(std::istream& in, size_t num_threads, std::function<void(const mapped_row&)> parse_func) {
   if (num_threads == 0) {
     streamRows(in, parse_func);
     return;
@@ -48,11 +49,14 @@ void streamRowsThreaded(std::istream& in, size_t num_threads, std::function<void
   if (in.bad() || in.fail()) {
     throw std::runtime_error("Bad input");
   }
-  std::istreambuf_iterator<char> it(in);
-  std::vector<std::string> header = detail::readCsvRow(it);
+  detail::block_reader reader(in);
+  std::vector<std::string> header;
+  reader.readRow(header);
+  detail::header_map index(header);
   pH::pool<detail::processMapped> thread_pool(num_threads);
-  while (it != detail::EOCSVF) {
-    thread_pool.emplace(header, detail::readCsvRow(it, header.size()), parse_func);
+  std::vector<std::string> row;
+  while (reader.readRow(row, header.size())) {
+    thread_pool.emplace(header, index, std::move(row), parse_func);
   }
 }
 
@@ -61,7 +65,7 @@ inline void streamRowsThreaded(const std::string& filename, size_t num_threads,
   streamRowsThreaded(in, num_threads, parse_func);
 }
 
-void streamRowsThreaded(std::istream& in, size_t num_threads, std::function<void(const std::vector<std::string>&)> parse_func) {
+inline void streamRowsThreaded(std::istream& in, size_t num_threads, std::function<void(const std::vector<std::string>&)> parse_func) {
   if (num_threads == 0) {
     streamRows(in, parse_func);
     return;
@@ -69,10 +73,11 @@ void streamRowsThreaded(std::istream& in, size_t num_threads, std::function<void
   if (in.bad() || in.fail()) {
     throw std::runtime_error("Bad input");
   }
-  std::istreambuf_iterator<char> it(in);
+  detail::block_reader reader(in);
   pH::pool<detail::processFlat> thread_pool(num_threads);
-  while (it != detail::EOCSVF) {
-    thread_pool.emplace(detail::readCsvRow(it), parse_func);
+  std::vector<std::string> row;
+  while (reader.readRow(row)) {
+    thread_pool.emplace(std::move(row), parse_func);
   }
 }
 
@@ -81,6 +86,462 @@ inline void streamRowsThreaded(const std::string& filename, size_t num_threads,
   streamRowsThreaded(in, num_threads, parse_func);
 }
 
+inline void streamRowsThreaded(std::istream& in, size_t num_threads, const projection& columns, std::function<void(const mapped_row&)> parse_func) {
+  if (num_threads == 0) {
+    streamRows(in, columns, parse_func);
+    return;
+  }
+  if (in.bad() || in.fail()) {
+    throw std::runtime_error("Bad input");
+  }
+  detail::block_reader reader(in);
+  std::vector<std::string> header;
+  reader.readRow(header);
+  detail::row_selector selector(reader, &header, &columns, nullptr);
+  detail::header_map index(selector.header());
+  pH::pool<detail::processMapped> thread_pool(num_threads);
+  std::vector<std::string> row;
+  while (selector.readRow(row)) {
+    thread_pool.emplace(selector.header(), index, std::move(row), parse_func);
+  }
+}
+
+inline void streamRowsThreaded(const std::string& filename, size_t num_threads, const projection& columns, std::function<void(const mapped_row&)> parse_func) {
+  std::ifstream in(filename, std::ios::in | std::ios::binary);
+  streamRowsThreaded(in, num_threads, columns, parse_func);
+}
+
+inline void streamRowsThreaded(std::istream& in, size_t num_threads, const projection& columns, std::function<void(const std::vector<std::string>&)> parse_func) {
+  if (num_threads == 0) {
+    streamRows(in, columns, parse_func);
+    return;
+  }
+  if (in.bad() || in.fail()) {
+    throw std::runtime_error("Bad input");
+  }
+  detail::block_reader reader(in);
+  detail::row_selector selector(reader, nullptr, &columns, nullptr);
+  pH::pool<detail::processFlat> thread_pool(num_threads);
+  std::vector<std::string> row;
+  while (selector.readRow(row)) {
+    thread_pool.emplace(std::move(row), parse_func);
+  }
+}
+
+inline void streamRowsThreaded(const std::string& filename, size_t num_threads, const projection& columns, std::function<void(const std::vector<std::string>&)> parse_func) {
+  std::ifstream in(filename, std::ios::in | std::ios::binary);
+  streamRowsThreaded(in, num_threads, columns, parse_func);
+}
+
+namespace detail {
+
+// Formats rows [begin, end) of data into out, each preceded by a newline if leading_newline or not
+// the first row. Fields are always formatted like csv_dialect, so writeThreaded only writes the
+// default dialect.
+inline void formatRows(const flat& data, size_t begin, size_t end, bool leading_newline, std::string& out) {
+  out.clear();
+  for (size_t row = begin; row < end; row++) {
+    if (row != begin || leading_newline) {
+      out += '\n';
+    }
+    for (size_t column = 0; column < data.columns(row); column++) {
+      if (column > 0) {
+        out += ',';
+      }
+      const std::string& field = data.at(row, column);
+      formatCsvField(field.data(), field.size(), out);
+    }
+  }
+}
+
+// Formats ranges of rows in parallel and writes them in order. The next ranges are formatted while
+// the previous ones are written.
+inline void writeThreaded(std::ostream& out, const flat& data, const std::vector<std::string>* header, size_t num_threads, size_t rows_per_job = 1 << 12) {
+  writer csv(out);
+  if (header != nullptr) {
+    csv.writeRow(*header);
+    if (data.rows() == 0) {
+      csv.writeRow(std::vector<std::string>());  // a header is always followed by a newline
+    }
+  }
+  csv.flush();
+  size_t jobs_per_round = 2 * num_threads;
+  std::vector<std::string> formatted(jobs_per_round);
+  std::vector<std::string> formatting(jobs_per_round);
+  size_t written = 0;
+  size_t row = 0;
+  pH::fpool thread_pool(num_threads);
+  do {
+    size_t jobs = 0;
+    for (; jobs < jobs_per_round && row < data.rows(); jobs++) {
+      size_t end = std::min(data.rows(), row + rows_per_job);
+      std::string& buffer = formatting[jobs];
+      bool leading_newline = row > 0 || header != nullptr;
+      thread_pool.push([&data, &buffer, row, end, leading_newline] { formatRows(data, row, end, leading_newline, buffer); });
+      row = end;
+    }
+    for (size_t i = 0; i < written; i++) {
+      out.write(formatted[i].data(), formatted[i].size());
+    }
+    thread_pool.wait();
+    std::swap(formatted, formatting);
+    written = jobs;
+  } while (written > 0);
+  if (out.bad() || out.fail()) {
+    throw std::runtime_error("Bad output");
+  }
+}
+
+}  // namespace detail
+
+// Writes data like pH::csv::flat::write, but formats blocks of rows in parallel on num_threads threads.
+// Only the default csv_dialect is supported.
+inline void writeThreaded(std::ostream& out, const flat& data, size_t num_threads) {
+  if (num_threads == 0) {
+    data.write(out);
+    return;
+  }
+  detail::writeThreaded(out, data, nullptr, num_threads);
+}
+
+inline void writeThreaded(const std::string& filename, const flat& data, size_t num_threads) {
+  std::ofstream out(filename, std::ios::out | std::ios::binary);
+  writeThreaded(out, data, num_threads);
+}
+
+inline void writeThreaded(std::ostream& out, const mapped& data, size_t num_threads, bool skip_header = false) {
+  if (num_threads == 0) {
+    data.write(out, skip_header);
+    return;
+  }
+  detail::writeThreaded(out, data, skip_header ? nullptr : &data.header(), num_threads);
+}
+
+inline void writeThreaded(const std::string& filename, const mapped& data, size_t num_threads, bool skip_header = false) {
+  std::ofstream out(filename, std::ios::out | std::ios::binary);
+  writeThreaded(out, data, num_threads, skip_header);
+}
+
+// Aggregate of a numeric column within each group, created with aggregate::sum, count, min or max.
+// Fields that are empty or not numbers are skipped.
+struct aggregate {
+  enum class type { sum, count, min, max };
+
+  static aggregate sum(std::string column) { return aggregate{std::move(column), type::sum}; }
+
+  // Rows in the group
+  static aggregate count() { return aggregate{std::string(), type::count}; }
+
+  // Numeric fields of column in the group
+  static aggregate count(std::string column) { return aggregate{std::move(column), type::count}; }
+
+  static aggregate min(std::string column) { return aggregate{std::move(column), type::min}; }
+
+  static aggregate max(std::string column) { return aggregate{std::move(column), type::max}; }
+
+  std::string name;  // empty for count() of rows
+  type kind;
+};
+
+namespace detail {
+
+// Running aggregates of one group
+struct group_values {
+  size_t rows;
+  std::vector<double> values;
+  std::vector<size_t> counts;  // numeric fields per aggregate
+};
+
+// Groups by key, built by one thread at a time and merged with the tables of the other threads
+class group_table {
+ public:
+  explicit group_table(const std::vector<aggregate>& aggregates) : aggregates_(aggregates), groups_(), key_() {}
+
+  group_values& find(const char* begin, const char* end) {
+    key_.assign(begin, end);
+    auto it = groups_.find(key_);
+    if (it == groups_.end()) {
+      group_values empty = {0, std::vector<double>(aggregates_.size()), std::vector<size_t>(aggregates_.size(), 0)};
+      for (size_t i = 0; i < aggregates_.size(); i++) {
+        empty.values[i] = aggregates_[i].kind == aggregate::type::min ? HUGE_VAL : aggregates_[i].kind == aggregate::type::max ? -HUGE_VAL : 0.0;
+      }
+      it = groups_.emplace(key_, std::move(empty)).first;
+    }
+    return it->second;
+  }
+
+  void add(group_values& group, size_t aggregate_index, const char* begin, const char* end) const {
+    double value;
+    if (parseValue(begin, end, value) != conversion_error::none) {
+      return;
+    }
+    group.counts[aggregate_index]++;
+    accumulate(aggregates_[aggregate_index].kind, group.values[aggregate_index], value, 1.0);
+  }
+
+  void merge(const group_table& other) {
+    for (const auto& entry : other.groups_) {
+      group_values& group = find(entry.first.data(), entry.first.data() + entry.first.size());
+      group.rows += entry.second.rows;
+      for (size_t i = 0; i < aggregates_.size(); i++) {
+        group.counts[i] += entry.second.counts[i];
+        accumulate(aggregates_[i].kind, group.values[i], entry.second.values[i], entry.second.values[i]);
+      }
+    }
+  }
+
+  inline std::unordered_map<std::string, group_values>& groups() { return groups_; }
+
+ private:
+  // Adds value to the aggregate, counted is the number of fields it stands for
+  static void accumulate(aggregate::type kind, double& result, double value, double counted) {
+    switch (kind) {
+      case aggregate::type::sum:
+        result += value;
+        break;
+      case aggregate::type::count:
+        result += counted;
+        break;
+      case aggregate::type::min:
+        result = std::min(result, value);
+        break;
+      case aggregate::type::max:
+        result = std::max(result, value);
+        break;
+    }
+  }
+
+  const std::vector<aggregate>& aggregates_;
+  std::unordered_map<std::string, group_values> groups_;
+  std::string key_;
+};
+
+// One group_table per thread. A job takes a free table and returns it when done, so tables are
+// never shared while rows are added.
+class group_tables {
+ public:
+  explicit group_tables(const std::vector<aggregate>& aggregates) : aggregates_(aggregates), mutex_(), tables_(), free_() {}
+
+  group_table* acquire() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_.empty()) {
+      tables_.emplace_back(new group_table(aggregates_));
+      return tables_.back().get();
+    }
+    group_table* table = free_.back();
+    free_.pop_back();
+    return table;
+  }
+
+  void release(group_table* table) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(table);
+  }
+
+  // Merges all tables into the first one, once all jobs are done
+  group_table& merge() {
+    acquire();
+    for (size_t i = 1; i < tables_.size(); i++) {
+      tables_.front()->merge(*tables_[i]);
+      tables_[i].reset();
+    }
+    return *tables_.front();
+  }
+
+ private:
+  const std::vector<aggregate>& aggregates_;
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<group_table>> tables_;
+  std::vector<group_table*> free_;
+};
+
+// Key and aggregated fields of a block of rows, copied from the reader buffer for a job
+struct group_batch {
+  std::string chars;
+  std::vector<size_t> ends;  // end of each field in chars, fields_per_row per row
+};
+
+// Adds a batch to a table. slots[i] is the field of aggregate i in each row, or npos for count().
+inline void addBatch(const group_batch& batch, size_t fields_per_row, const std::vector<size_t>& slots, group_table& table) {
+  const char* chars = batch.chars.data();
+  for (size_t first = 0; first < batch.ends.size(); first += fields_per_row) {
+    size_t key_begin = first == 0 ? 0 : batch.ends[first - 1];
+    group_values& group = table.find(chars + key_begin, chars + batch.ends[first]);
+    group.rows++;
+    for (size_t i = 0; i < slots.size(); i++) {
+      if (slots[i] != std::string::npos) {
+        size_t field = first + slots[i];
+        table.add(group, i, chars + batch.ends[field - 1], chars + batch.ends[field]);
+      }
+    }
+  }
+}
+
+// Resolves the aggregated columns against the header. columns gets the column of each copied
+// field, the key first, and slots the field of each aggregate.
+inline void resolveAggregates(const std::vector<std::string>& header, const std::string& key, const std::vector<aggregate>& aggregates, std::vector<size_t>& columns, std::vector<size_t>& slots) {
+  columns.assign(1, headerIndex(header, key));
+  slots.clear();
+  for (const aggregate& value : aggregates) {
+    if (value.name.empty()) {
+      slots.push_back(std::string::npos);
+      continue;
+    }
+    size_t column = headerIndex(header, value.name);
+    size_t slot = std::find(columns.begin() + 1, columns.end(), column) - columns.begin();
+    if (slot == columns.size()) {
+      columns.push_back(column);
+    }
+    slots.push_back(slot);
+  }
+}
+
+}  // namespace detail
+
+// Aggregates per group, from pH::csv::groupByThreaded
+class grouped {
+ public:
+  grouped(std::vector<aggregate> aggregates, std::unordered_map<std::string, detail::group_values>&& groups)
+    : aggregates_(std::move(aggregates)), groups_(std::move(groups)) {}
+
+  // Number of groups
+  inline size_t size() const { return groups_.size(); }
+
+  // Sorted keys of the groups
+  std::vector<std::string> keys() const {
+    std::vector<std::string> result;
+    result.reserve(groups_.size());
+    for (const auto& entry : groups_) {
+      result.push_back(entry.first);
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+  }
+
+  inline bool contains(const std::string& key) const { return groups_.count(key) > 0; }
+
+  inline size_t rows(const std::string& key) const { return group(key).rows; }
+
+  // Value of the aggregate at index in the list given to groupByThreaded. min and max are NaN if
+  // the group has no numeric fields in the column.
+  double at(const std::string& key, size_t index) const {
+    const detail::group_values& values = group(key);
+    const aggregate& value = aggregates_.at(index);
+    if (value.kind == aggregate::type::count && value.name.empty()) {
+      return static_cast<double>(values.rows);
+    }
+    if ((value.kind == aggregate::type::min || value.kind == aggregate::type::max) && values.counts[index] == 0) {
+      return std::numeric_limits<double>::quiet_NaN();
+    }
+    return values.values[index];
+  }
+
+ private:
+  const detail::group_values& group(const std::string& key) const {
+    auto it = groups_.find(key);
+    if (it == groups_.end()) {
+      throw std::out_of_range("Group " + key + " not found");
+    }
+    return it->second;
+  }
+
+  std::vector<aggregate> aggregates_;
+  std::unordered_map<std::string, detail::group_values> groups_;
+};
+
+// Groups rows by the key column and computes the aggregates of each group in parallel. Blocks of
+// rows are aggregated on num_threads threads into one table per thread, and the tables are merged
+// at the end, so threads never wait for each other. The input must have a header.
+inline grouped groupByThreaded(std::istream& in, size_t num_threads, const std::string& key, const std::vector<aggregate>& aggregates, size_t rows_per_job = 1 << 12) {
+  if (in.bad() || in.fail()) {
+    throw std::runtime_error("Bad input");
+  }
+  detail::block_reader reader(in);
+  std::vector<std::string> header;
+  reader.readRow(header);
+  std::vector<size_t> columns;
+  std::vector<size_t> slots;
+  detail::resolveAggregates(header, key, aggregates, columns, slots);
+  size_t fields_per_row = columns.size();
+  detail::group_tables tables(aggregates);
+  {
+    pH::fpool thread_pool(num_threads, true);
+    std::shared_ptr<detail::group_batch> batch = std::make_shared<detail::group_batch>();
+    std::vector<detail::raw_field> fields;
+    bool done = false;
+    while (!done) {
+      done = !reader.readFields(fields);
+      if (!done) {
+        for (size_t column : columns) {
+          if (column < fields.size()) {
+            detail::appendCsvField(fields[column], batch->chars);
+          }
+          batch->ends.push_back(batch->chars.size());
+        }
+      }
+      if (batch->ends.size() < rows_per_job * fields_per_row && !(done && !batch->ends.empty())) {
+        continue;
+      }
+      auto job = [batch, fields_per_row, &slots, &tables] {
+        detail::group_table* table = tables.acquire();
+        detail::addBatch(*batch, fields_per_row, slots, *table);
+        tables.release(table);
+      };
+      if (num_threads == 0) {
+        job();
+      } else {
+        thread_pool.push(job);
+      }
+      batch = std::make_shared<detail::group_batch>();
+    }
+  }
+  return grouped(aggregates, std::move(tables.merge().groups()));
+}
+
+inline grouped groupByThreaded(const std::string& filename, size_t num_threads, const std::string& key, const std::vector<aggregate>& aggregates, size_t rows_per_job = 1 << 12) {
+  std::ifstream in(filename, std::ios::in | std::ios::binary);
+  return groupByThreaded(in, num_threads, key, aggregates, rows_per_job);
+}
+
+// As above, for a table that is already read. Each thread aggregates ranges of rows.
+inline grouped groupByThreaded(const mapped& data, size_t num_threads, const std::string& key, const std::vector<aggregate>& aggregates, size_t rows_per_job = 1 << 12) {
+  std::vector<size_t> columns;
+  std::vector<size_t> slots;
+  detail::resolveAggregates(data.header(), key, aggregates, columns, slots);
+  detail::group_tables tables(aggregates);
+  {
+    pH::fpool thread_pool(num_threads, true);
+    for (size_t begin = 0; begin < data.rows(); begin += rows_per_job) {
+      size_t end = std::min(data.rows(), begin + rows_per_job);
+      auto job = [&data, &columns, &slots, &tables, begin, end] {
+        static const std::string missing;
+        const flat& fields = data;  // rows longer or shorter than the header
+        detail::group_table* table = tables.acquire();
+        for (size_t row = begin; row < end; row++) {
+          size_t row_columns = fields.columns(row);
+          const std::string& key_field = columns[0] < row_columns ? data.at(row, columns[0]) : missing;
+          detail::group_values& group = table->find(key_field.data(), key_field.data() + key_field.size());
+          group.rows++;
+          for (size_t i = 0; i < slots.size(); i++) {
+            if (slots[i] != std::string::npos) {
+              size_t column = columns[slots[i]];
+              const std::string& field = column < row_columns ? data.at(row, column) : missing;
+              table->add(group, i, field.data(), field.data() + field.size());
+            }
+          }
+        }
+        tables.release(table);
+      };
+      if (num_threads == 0) {
+        job();
+      } else {
+        thread_pool.push(job);
+      }
+    }
+  }
+  return grouped(aggregates, std::move(tables.merge().groups()));
+}
+
 }  // namespace csv
 
 }  // namespace pH
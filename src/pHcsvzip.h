@@ -0,0 +1,346 @@
+#pragma once
+
+#include "pHcsv.h"
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <thread>
+
+#include <zlib.h>
+#ifdef PH_CSV_ZSTD
+#include <zstd.h>
+#endif
+
+namespace pH {
+
+namespace csv {
+
+namespace detail {
+
+// Bounded queue of decompressed chunks between the decompression thread and the parser. Chunks are
+// recycled to avoid allocations.
+class chunk_queue {
+ public:
+  chunk_queue(size_t chunks, size_t chunk_size)
+    : mutex_(), changed_(), full_(), free_(), chunks_(chunks), chunk_size_(chunk_size), closed_(false), stopped_(false) {}
+
+  // Returns an empty chunk to fill, or false if the reader stopped
+  bool acquire(std::vector<char>& chunk) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [this] { return stopped_ || full_.size() < chunks_; });
+    if (stopped_) {
+      return false;
+    }
+    if (free_.empty()) {
+      chunk.reserve(chunk_size_);
+    } else {
+      chunk = std::move(free_.back());
+      free_.pop_back();
+    }
+    chunk.clear();
+    return true;
+  }
+
+  void push(std::vector<char>&& chunk) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    full_.push_back(std::move(chunk));
+    changed_.notify_all();
+  }
+
+  // Marks the end of the input
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    changed_.notify_all();
+  }
+
+  // Exchanges a consumed chunk for the next one, returns false at end of input
+  bool pop(std::vector<char>& chunk) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (chunk.capacity() > 0) {
+      free_.push_back(std::move(chunk));
+      chunk = std::vector<char>();
+    }
+    changed_.wait(lock, [this] { return closed_ || !full_.empty(); });
+    if (full_.empty()) {
+      return false;
+    }
+    chunk = std::move(full_.front());
+    full_.pop_front();
+    changed_.notify_all();
+    return true;
+  }
+
+  // Makes the decompression thread give up, when the reader is destroyed before the end
+  void stop() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+    changed_.notify_all();
+  }
+
+  inline size_t chunkSize() const { return chunk_size_; }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::deque<std::vector<char>> full_;
+  std::vector<std::vector<char>> free_;
+  size_t chunks_;
+  size_t chunk_size_;
+  bool closed_;
+  bool stopped_;
+};
+
+enum class compression {
+  none,
+  gzip,
+  zstd
+};
+
+// Detects the format from the magic bytes at the start of the input
+inline compression detectCompression(const char* data, size_t size) {
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+  if (size >= 2 && bytes[0] == 0x1f && bytes[1] == 0x8b) {
+    return compression::gzip;
+  }
+  if (size >= 4 && bytes[0] == 0x28 && bytes[1] == 0xb5 && bytes[2] == 0x2f && bytes[3] == 0xfd) {
+    return compression::zstd;
+  }
+  return compression::none;
+}
+
+// Reads compressed input on a separate thread and passes the decompressed data through a
+// chunk_queue, so decompression overlaps with parsing
+class decompress_streambuf : public std::streambuf {
+ public:
+  decompress_streambuf(std::unique_ptr<std::istream> owned, std::istream& in, size_t chunks, size_t chunk_size)
+    : owned_(std::move(owned)), in_(in), queue_(std::max<size_t>(chunks, 1), std::max<size_t>(chunk_size, 1)), chunk_(), error_(), thread_() {
+    thread_ = std::thread(&decompress_streambuf::run, this);
+  }
+
+  decompress_streambuf(const decompress_streambuf& other) = delete;
+  decompress_streambuf& operator=(const decompress_streambuf& other) = delete;
+
+  ~decompress_streambuf() {
+    queue_.stop();
+    thread_.join();
+  }
+
+ protected:
+  int_type underflow() override {
+    if (gptr() == egptr() && !next()) {
+      return traits_type::eof();
+    }
+    return traits_type::to_int_type(*gptr());
+  }
+
+  std::streamsize xsgetn(char* data, std::streamsize size) override {
+    std::streamsize copied = 0;
+    while (copied < size && (gptr() != egptr() || next())) {
+      std::streamsize count = std::min<std::streamsize>(size - copied, egptr() - gptr());
+      std::memcpy(data + copied, gptr(), count);
+      gbump(static_cast<int>(count));
+      copied += count;
+    }
+    return copied;
+  }
+
+ private:
+  // Moves to the next chunk, rethrowing errors from the decompression thread at the end
+  bool next() {
+    if (!queue_.pop(chunk_)) {
+      setg(nullptr, nullptr, nullptr);
+      if (error_) {
+        std::rethrow_exception(error_);
+      }
+      return false;
+    }
+    setg(chunk_.data(), chunk_.data(), chunk_.data() + chunk_.size());
+    return true;
+  }
+
+  void run() {
+    try {
+      std::vector<char> input(1 << 16);
+      size_t size = read(input.data(), 4);
+      switch (detectCompression(input.data(), size)) {
+        case compression::gzip:
+          inflateGzip(input, size);
+          break;
+        case compression::zstd:
+          inflateZstd(input, size);
+          break;
+        default:
+          copy(input, size);
+      }
+    } catch (...) {
+      error_ = std::current_exception();
+    }
+    queue_.close();
+  }
+
+  // Reads until size bytes are read or the input ends
+  size_t read(char* data, size_t size) {
+    size_t total = 0;
+    while (total < size) {
+      std::streamsize count = in_.rdbuf()->sgetn(data + total, size - total);
+      if (count <= 0) {
+        break;
+      }
+      total += static_cast<size_t>(count);
+    }
+    return total;
+  }
+
+  void copy(std::vector<char>& input, size_t size) {
+    std::vector<char> chunk;
+    while (size > 0) {
+      if (!queue_.acquire(chunk)) {
+        return;
+      }
+      chunk.assign(input.data(), input.data() + size);
+      queue_.push(std::move(chunk));
+      size = read(input.data(), input.size());
+    }
+  }
+
+  void inflateGzip(std::vector<char>& input, size_t size) {
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, 15 + 32) != Z_OK) {
+      throw std::runtime_error("Unable to initialize gzip decompression");
+    }
+    std::unique_ptr<z_stream, int (*)(z_stream*)> cleanup(&stream, inflateEnd);
+    stream.next_in = reinterpret_cast<Bytef*>(input.data());
+    stream.avail_in = static_cast<uInt>(size);
+    std::vector<char> chunk;
+    bool done = false;
+    while (!done) {
+      if (!queue_.acquire(chunk)) {
+        return;
+      }
+      chunk.resize(queue_.chunkSize());
+      stream.next_out = reinterpret_cast<Bytef*>(chunk.data());
+      stream.avail_out = static_cast<uInt>(chunk.size());
+      while (stream.avail_out > 0) {
+        if (stream.avail_in == 0) {
+          stream.next_in = reinterpret_cast<Bytef*>(input.data());
+          stream.avail_in = static_cast<uInt>(read(input.data(), input.size()));
+        }
+        bool input_ended = stream.avail_in == 0;
+        int result = inflate(&stream, Z_NO_FLUSH);
+        if (result == Z_STREAM_END) {
+          // Concatenated gzip files are decompressed as one
+          if (stream.avail_in == 0) {
+            stream.next_in = reinterpret_cast<Bytef*>(input.data());
+            stream.avail_in = static_cast<uInt>(read(input.data(), input.size()));
+          }
+          if (stream.avail_in == 0) {
+            done = true;
+            break;
+          }
+          inflateReset(&stream);
+        } else if (result == Z_BUF_ERROR && input_ended) {
+          throw std::runtime_error("Truncated gzip input");
+        } else if (result != Z_OK && result != Z_BUF_ERROR) {
+          throw std::runtime_error("Bad gzip input");
+        }
+      }
+      chunk.resize(chunk.size() - stream.avail_out);
+      queue_.push(std::move(chunk));
+    }
+  }
+
+#ifdef PH_CSV_ZSTD
+  void inflateZstd(std::vector<char>& input, size_t size) {
+    std::unique_ptr<ZSTD_DStream, size_t (*)(ZSTD_DStream*)> stream(ZSTD_createDStream(), ZSTD_freeDStream);
+    if (!stream || ZSTD_isError(ZSTD_initDStream(stream.get()))) {
+      throw std::runtime_error("Unable to initialize zstd decompression");
+    }
+    ZSTD_inBuffer in = {input.data(), size, 0};
+    std::vector<char> chunk;
+    size_t frame_left = 1;  // 0 after a complete frame
+    bool done = false;
+    while (!done) {
+      if (!queue_.acquire(chunk)) {
+        return;
+      }
+      chunk.resize(queue_.chunkSize());
+      ZSTD_outBuffer out = {chunk.data(), chunk.size(), 0};
+      while (out.pos < out.size) {
+        if (in.pos == in.size) {
+          in.size = read(input.data(), input.size());
+          in.pos = 0;
+          if (in.size == 0) {
+            if (frame_left != 0) {
+              throw std::runtime_error("Truncated zstd input");
+            }
+            done = true;
+            break;
+          }
+        }
+        frame_left = ZSTD_decompressStream(stream.get(), &out, &in);
+        if (ZSTD_isError(frame_left)) {
+          throw std::runtime_error("Bad zstd input");
+        }
+      }
+      chunk.resize(out.pos);
+      queue_.push(std::move(chunk));
+    }
+  }
+#else
+  void inflateZstd(std::vector<char>&, size_t) {
+    throw std::runtime_error("zstd input requires PH_CSV_ZSTD to be defined and libzstd to be linked");
+  }
+#endif
+
+  std::unique_ptr<std::istream> owned_;
+  std::istream& in_;
+  chunk_queue queue_;
+  std::vector<char> chunk_;
+  std::exception_ptr error_;
+  std::thread thread_;
+};
+
+}  // namespace detail
+
+// std::istream decompressing gzip or zstd input, detected from its magic bytes, on a separate
+// thread. Uncompressed input is passed through unchanged. Use it with any reader taking a
+// std::istream. Decompressed data is passed to the parser in chunks of chunk_size bytes, and at
+// most chunks of them are buffered.
+class compressed_istream : public std::istream {
+ public:
+  explicit compressed_istream(const std::string& filename, size_t chunks = 4, size_t chunk_size = 1 << 20)
+    : std::istream(nullptr), buffer_() {
+    std::unique_ptr<std::istream> file(new std::ifstream(filename, std::ios::in | std::ios::binary));
+    if (file->fail()) {
+      setstate(std::ios::failbit);
+      return;
+    }
+    std::istream& in = *file;
+    buffer_.reset(new detail::decompress_streambuf(std::move(file), in, chunks, chunk_size));
+    rdbuf(buffer_.get());
+  }
+
+  // in must outlive the compressed_istream
+  explicit compressed_istream(std::istream& in, size_t chunks = 4, size_t chunk_size = 1 << 20)
+    : std::istream(nullptr), buffer_() {
+    if (in.fail()) {
+      setstate(std::ios::failbit);
+      return;
+    }
+    buffer_.reset(new detail::decompress_streambuf(nullptr, in, chunks, chunk_size));
+    rdbuf(buffer_.get());
+  }
+
+ private:
+  std::unique_ptr<detail::decompress_streambuf> buffer_;
+};
+
+}  // namespace csv
+
+}  // namespace pH
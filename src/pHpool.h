@@ -4,6 +4,8 @@
 #include <deque>
 #include <vector>
 #include <condition_variable>
+#include <functional>
+#include <mutex>
 
 namespace pH {
 
@@ -1,5 +1,7 @@
 #include "pHcsv.h"
 
+#include <sstream>
+
 const std::string TMP_FILE = "tmp.csv";
 
 template<typename T>
@@ -12,6 +14,16 @@ inline std::string toString(const std::string& val) {
   return val;
 }
 
+template<>
+inline std::string toString(const pH::csv::view& val) {
+  return val.str();
+}
+
+template<>
+inline std::string toString(const pH::csv::column_type& val) {
+  return std::to_string(static_cast<int>(val));
+}
+
 #define ASSERT_EQ(expr, expected) if ((expr) != (expected)) { printf("Assert failed at line %d:\n  %s != %s\n", __LINE__, toString(expr).c_str(), #expected); return 1; }
 
 int test_mapped_wiki() {
@@ -155,6 +167,149 @@ int test_streaming() {
   return 0;
 }
 
+int test_schema() {
+  using pH::csv::column;
+  std::vector<Car> expected;
+  pH::csv::streamRows(TESTDATA_DIR "/wiki_extended.csv", [&expected] (const pH::csv::mapped_row& row) {
+    expected.push_back(parseCar(row));
+  });
+
+  auto car_schema = pH::csv::makeSchema(
+      column("Year", &Car::year),
+      column("Make", &Car::make),
+      column("Model", &Car::model),
+      column("Description", &Car::description),
+      column(4, &Car::price),
+      column("Extras", &Car::extras));
+  std::vector<Car> cars;
+  pH::csv::streamRows(TESTDATA_DIR "/wiki_extended.csv", car_schema, [&cars] (Car&& car) {
+    cars.push_back(std::move(car));
+  });
+  ASSERT_EQ(cars.size(), expected.size());
+  for (size_t i = 0; i < cars.size(); i++) {
+    ASSERT_EQ(cars[i].year, expected[i].year);
+    ASSERT_EQ(cars[i].make, expected[i].make);
+    ASSERT_EQ(cars[i].model, expected[i].model);
+    ASSERT_EQ(cars[i].description, expected[i].description);
+    ASSERT_EQ(cars[i].price, expected[i].price);
+    ASSERT_EQ(cars[i].extras, expected[i].extras);
+  }
+
+  // Headerless files are bound by index
+  auto indexed_schema = pH::csv::makeSchema(column(0, &Car::year), column(4, &Car::price), column(5, &Car::extras));
+  cars.clear();
+  pH::csv::streamRows(TESTDATA_DIR "/wiki_extended_no_header.csv", indexed_schema, [&cars] (const Car& car) {
+    cars.push_back(car);
+  });
+  ASSERT_EQ(cars.size(), 4);
+  ASSERT_EQ(cars[3].year, 1996);
+  ASSERT_EQ(cars[3].price, 4799.0);
+  ASSERT_EQ(cars[0].extras, "steering \"wheel\"");
+  ASSERT_EQ(cars[3].extras, "");
+
+  // Files with header can also be bound by index only
+  std::vector<Car> indexed_cars;
+  pH::csv::streamRows(TESTDATA_DIR "/wiki_extended.csv", indexed_schema, true, [&indexed_cars] (Car&& car) {
+    indexed_cars.push_back(std::move(car));
+  });
+  ASSERT_EQ(indexed_cars.size(), cars.size());
+  for (size_t i = 0; i < cars.size(); i++) {
+    ASSERT_EQ(indexed_cars[i].year, cars[i].year);
+    ASSERT_EQ(indexed_cars[i].price, cars[i].price);
+    ASSERT_EQ(indexed_cars[i].extras, cars[i].extras);
+  }
+
+  // Column names need a header
+  bool named_without_header = false;
+  try {
+    pH::csv::streamRows(TESTDATA_DIR "/wiki_extended_no_header.csv", car_schema, false, [] (Car&&) {});
+  } catch (const std::runtime_error&) {
+    named_without_header = true;
+  }
+  ASSERT_EQ(named_without_header, true);
+
+  // Empty fields can be given a value, otherwise they are parsed like other fields
+  std::istringstream in("Year,Price\n1997,\n");
+  pH::csv::streamRows(in, pH::csv::makeSchema(column("Year", &Car::year), column("Price", &Car::price, 0)), [&cars] (Car&& car) {
+    cars.push_back(std::move(car));
+  });
+  ASSERT_EQ(cars.back().year, 1997);
+  ASSERT_EQ(cars.back().price, 0.0);
+
+  // Columns past the end of a short row are empty fields
+  std::istringstream short_in("Year,Price\n1998\n");
+  pH::csv::streamRows(short_in, pH::csv::makeSchema(column("Year", &Car::year), column("Price", &Car::price, -1)), [&cars] (Car&& car) {
+    cars.push_back(std::move(car));
+  });
+  ASSERT_EQ(cars.back().year, 1998);
+  ASSERT_EQ(cars.back().price, -1.0);
+  ASSERT_EQ(pH::csv::detail::missingField().end - pH::csv::detail::missingField().begin, 0);
+
+  bool threw = false;
+  try {
+    pH::csv::streamRows(TESTDATA_DIR "/wiki_extended.csv", pH::csv::makeSchema(column("Make", &Car::price)), [] (Car&&) {});
+  } catch (const std::invalid_argument&) {
+    threw = true;
+  }
+  ASSERT_EQ(threw, true);
+  return 0;
+}
+
+int test_conversion() {
+  using pH::csv::conversion_error;
+  double d = 0.0;
+  ASSERT_EQ(static_cast<int>(pH::csv::parse("4799.00", d)), static_cast<int>(conversion_error::none));
+  ASSERT_EQ(d, 4799.0);
+  ASSERT_EQ(static_cast<int>(pH::csv::parse(" -1.5e3\r", d)), static_cast<int>(conversion_error::none));
+  ASSERT_EQ(d, -1500.0);
+  ASSERT_EQ(static_cast<int>(pH::csv::parse("", d)), static_cast<int>(conversion_error::empty));
+  ASSERT_EQ(static_cast<int>(pH::csv::parse("12abc", d)), static_cast<int>(conversion_error::invalid));
+  ASSERT_EQ(static_cast<int>(pH::csv::parse("1e400", d)), static_cast<int>(conversion_error::out_of_range));
+
+  // Doubles printed with 17 significant digits must round trip exactly
+  for (double value : {0.1, 1.0 / 3.0, 2.2250738585072014e-308, 4.9406564584124654e-324, 1.7976931348623157e308, 9007199254740993.0}) {
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%.17g", value);
+    ASSERT_EQ(static_cast<int>(pH::csv::parse(buffer, d)), static_cast<int>(conversion_error::none));
+    ASSERT_EQ(d, value);
+  }
+
+  int i = 0;
+  ASSERT_EQ(static_cast<int>(pH::csv::parse("-2147483648", i)), static_cast<int>(conversion_error::none));
+  ASSERT_EQ(i, -2147483648);
+  ASSERT_EQ(static_cast<int>(pH::csv::parse("2147483648", i)), static_cast<int>(conversion_error::out_of_range));
+  size_t u = 0;
+  ASSERT_EQ(static_cast<int>(pH::csv::parse("-1", u)), static_cast<int>(conversion_error::invalid));
+  bool b = false;
+  ASSERT_EQ(static_cast<int>(pH::csv::parse("TRUE", b)), static_cast<int>(conversion_error::none));
+  ASSERT_EQ(b, true);
+
+  // Conversions in get() throw, unless an empty value is given for empty fields
+  pH::csv::mapped data(TESTDATA_DIR "/wiki.csv");
+  data.at(1, "Price") = "";
+  bool threw = false;
+  try {
+    data.get<double>(1, "Price");
+  } catch (const std::invalid_argument&) {
+    threw = true;
+  }
+  ASSERT_EQ(threw, true);
+  ASSERT_EQ(data.get<double>(1, "Price", -1.0), -1.0);
+  ASSERT_EQ(data.get(0, "Price", -1.0), 3000.0);
+
+  std::vector<double> prices = data.getColumn<double>("Price", 0.0);
+  ASSERT_EQ(prices.size(), 4);
+  ASSERT_EQ(prices[0], 3000.0);
+  ASSERT_EQ(prices[1], 0.0);
+  ASSERT_EQ(prices[3], 4799.0);
+
+  pH::csv::mapped_columnar columnar_data(TESTDATA_DIR "/wiki.csv");
+  std::vector<int> years = columnar_data.getColumn<int>("Year");
+  ASSERT_EQ(years.size(), 4);
+  ASSERT_EQ(years[3], 1996);
+  return 0;
+}
+
 int test_create_csv() {
   pH::csv::flat flat_data;
   flat_data.resizeColumns(3);
@@ -167,6 +322,7 @@ int test_create_csv() {
   mapped_data.write(TMP_FILE);
 
   pH::csv::mapped written_data(TMP_FILE);
+  std::remove(TMP_FILE.c_str());
   ASSERT_EQ(written_data.rows(), 1);
   ASSERT_EQ(written_data.columns(), 3);
   ASSERT_EQ(written_data.get<int>(0, "Year"), 2019);
@@ -187,6 +343,1040 @@ int test_create_csv() {
   return 0;
 }
 
+std::vector<std::string> readFile(const std::string& filename) {
+  std::ifstream in(filename, std::ios::in | std::ios::binary);
+  return {std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>())};
+}
+
+std::vector<std::string> parserTestCases() {
+  std::vector<std::string> cases = {
+    "",
+    "a,b,\n",
+    "a,b,",
+    "\n\n",
+    "\"a\"\"\",\"\"\"\",\"\n\"",
+    "a\"\"b,\"x\"y,z\"\n\"unterminated\"\"",
+    "1,\"2,3\"\"\",4\r\n5,6",
+    std::string(100, 'x') + "," + std::string(70, '"') + ",\"" + std::string(63, ',') + "\"\n" + std::string(130, '\n')
+  };
+  for (const char* file : {"/wiki.csv", "/wiki_extended.csv", "/wiki_extended_no_header.csv"}) {
+    cases.push_back(readFile(TESTDATA_DIR + std::string(file)).front());
+  }
+  return cases;
+}
+
+std::vector<std::vector<std::string>> referenceRows(const std::string& csv) {
+  std::istringstream in(csv);
+  std::istreambuf_iterator<char> it(in);
+  std::vector<std::vector<std::string>> rows;
+  while (it != pH::csv::detail::EOCSVF) {
+    rows.push_back(pH::csv::detail::readCsvRow(it));
+  }
+  return rows;
+}
+
+int test_tokenizer() {
+  using pH::csv::detail::simd;
+  for (simd level : {simd::none, simd::sse2, simd::avx2}) {
+    if (!pH::csv::detail::useSimd(level)) {
+      continue;
+    }
+    for (const std::string& csv : parserTestCases()) {
+      auto expected = referenceRows(csv);
+      for (size_t block_size : {1, 2, 3, 7, 64, 1 << 16}) {
+        std::istringstream in(csv);
+        pH::csv::detail::block_reader reader(in, block_size);
+        std::vector<std::vector<std::string>> rows;
+        std::vector<std::string> row;
+        while (reader.readRow(row)) {
+          rows.push_back(row);
+        }
+        if (rows != expected) {
+          printf("Tokenizer output differs from readCsvRow for simd level %d and block size %zu:\n%s\n", static_cast<int>(level), block_size, csv.c_str());
+          return 1;
+        }
+      }
+    }
+  }
+  pH::csv::detail::useSimd(simd::avx2) || pH::csv::detail::useSimd(simd::sse2);
+  return 0;
+}
+
+int test_columnar() {
+  for (const std::string& csv : parserTestCases()) {
+    std::istringstream flat_in(csv);
+    std::istringstream columnar_in(csv);
+    pH::csv::flat data(flat_in);
+    pH::csv::columnar columnar_data(columnar_in);
+    ASSERT_EQ(columnar_data.rows(), data.rows());
+    ASSERT_EQ(columnar_data.columns(), data.columns());
+    for (size_t row = 0; row < data.rows(); row++) {
+      for (size_t column = 0; column < data.columns(); column++) {
+        ASSERT_EQ(columnar_data.at(row, column), column < data.columns(row) ? data.at(row, column) : "");
+      }
+    }
+  }
+
+  pH::csv::mapped_columnar data(TESTDATA_DIR "/wiki_extended.csv");
+  ASSERT_EQ(data.rows(), 4);
+  ASSERT_EQ(data.columns(), 6);
+  ASSERT_EQ(data.at(0, "Extras"), "steering \"wheel\"");
+  ASSERT_EQ(data.at(0, "Extras"), data.at(0, 5));
+  ASSERT_EQ(data.at(2, "Model"), "Venture \"Extended Edition, Very Large\"");
+  ASSERT_EQ(data.at(3, "Description"), "MUST SELL!\nair, moon \"\"roof\"\", loaded");
+  ASSERT_EQ(data.at(3, "Extras"), "");
+  ASSERT_EQ(data.get<int>(0, "Year"), 1997);
+  ASSERT_EQ(data.get<size_t>(3, "Year"), 1996);
+  ASSERT_EQ(data.get<double>(1, 4), 4900.0);
+  return 0;
+}
+
+int test_typed_columnar() {
+  for (const std::string& csv : parserTestCases()) {
+    std::istringstream flat_in(csv);
+    std::istringstream typed_in(csv);
+    pH::csv::flat data(flat_in);
+    pH::csv::typed_columnar typed_data(typed_in, 2);
+    ASSERT_EQ(typed_data.rows(), data.rows());
+    ASSERT_EQ(typed_data.columns(), data.columns());
+    for (size_t row = 0; row < data.rows(); row++) {
+      for (size_t column = 0; column < data.columns(); column++) {
+        std::string field = column < data.columns(row) ? data.at(row, column) : "";
+        // Every field keeps its text, native values are also compared as values
+        ASSERT_EQ(typed_data.str(row, column), field);
+        ASSERT_EQ(typed_data.get(row, column), field);
+        if (!typed_data.native(row, column)) {
+          continue;
+        } else if (typed_data.type(column) == pH::csv::column_type::int64) {
+          ASSERT_EQ(typed_data.get<int64_t>(row, column), pH::csv::detail::convert<int64_t>(field));
+        } else if (typed_data.type(column) == pH::csv::column_type::float64) {
+          ASSERT_EQ(typed_data.get<double>(row, column), pH::csv::detail::convert<double>(field));
+        } else {
+          ASSERT_EQ(typed_data.get<bool>(row, column), pH::csv::detail::convert<bool>(field));
+        }
+      }
+    }
+  }
+
+  pH::csv::mapped_typed_columnar data(TESTDATA_DIR "/wiki_extended.csv");
+  pH::csv::mapped text(TESTDATA_DIR "/wiki_extended.csv");
+  ASSERT_EQ(data.rows(), text.rows());
+  ASSERT_EQ(data.type("Year"), pH::csv::column_type::int64);
+  ASSERT_EQ(data.type("Price"), pH::csv::column_type::float64);
+  ASSERT_EQ(data.type("Model"), pH::csv::column_type::string);
+  for (size_t row = 0; row < text.rows(); row++) {
+    ASSERT_EQ(data.get<int>(row, "Year"), text.get<int>(row, "Year"));
+    ASSERT_EQ(data.get<double>(row, "Year"), text.get<double>(row, "Year"));
+    ASSERT_EQ(data.get<double>(row, "Price"), text.get<double>(row, "Price"));
+    ASSERT_EQ(data.get(row, "Description"), text.at(row, "Description"));
+    ASSERT_EQ(data.get(row, "Extras"), text.at(row, "Extras"));
+  }
+  ASSERT_EQ(data.integers("Year")[3], 1996);
+  ASSERT_EQ(data.reals("Price")[1], 4900.0);
+  ASSERT_EQ(data.str(0, "Price"), "3000.00");
+  ASSERT_EQ(data.get(0, "Price"), "3000.00");
+  ASSERT_EQ(data.str(0, "Year"), "1997");
+
+  // Fields that don't match the sampled type are kept as strings
+  std::istringstream in("1,2.5,true,a\n2,x,false,b\n3,,TRUE,c\n99999999999,1e3,0,d,late\n");
+  pH::csv::typed_columnar sampled(in, 1);
+  ASSERT_EQ(sampled.rows(), 4);
+  ASSERT_EQ(sampled.columns(), 5);
+  ASSERT_EQ(sampled.type(0), pH::csv::column_type::int64);
+  ASSERT_EQ(sampled.type(1), pH::csv::column_type::float64);
+  ASSERT_EQ(sampled.type(2), pH::csv::column_type::boolean);
+  ASSERT_EQ(sampled.type(3), pH::csv::column_type::string);
+  ASSERT_EQ(sampled.type(4), pH::csv::column_type::string);
+  ASSERT_EQ(sampled.get<int64_t>(3, 0), 99999999999);
+  bool threw = false;
+  try {
+    sampled.get<int>(3, 0);
+  } catch (const std::out_of_range&) {
+    threw = true;
+  }
+  ASSERT_EQ(threw, true);
+  ASSERT_EQ(sampled.native(1, 1), false);
+  ASSERT_EQ(sampled.str(1, 1), "x");
+  threw = false;
+  try {
+    sampled.get<double>(1, 1);
+  } catch (const std::invalid_argument&) {
+    threw = true;
+  }
+  ASSERT_EQ(threw, true);
+  ASSERT_EQ(sampled.native(2, 1), false);
+  ASSERT_EQ(sampled.get<double>(2, 1, -1.0), -1.0);
+  ASSERT_EQ(sampled.get<double>(3, 1), 1000.0);
+  ASSERT_EQ(sampled.getColumn<bool>(2) == std::vector<bool>({true, false, true, false}), true);
+  ASSERT_EQ(sampled.str(2, 2), "TRUE");
+  ASSERT_EQ(sampled.str(3, 1), "1e3");
+
+  // Values keep their text if it would be formatted differently
+  std::istringstream formatted_in("0,1.5,1\n007,2.50,0.1\n-5,-0,12345678901234567\n-12, 3,1e+20\n");
+  pH::csv::typed_columnar formatted(formatted_in, 1);
+  ASSERT_EQ(formatted.type(0), pH::csv::column_type::int64);
+  ASSERT_EQ(formatted.type(1), pH::csv::column_type::float64);
+  ASSERT_EQ(formatted.type(2), pH::csv::column_type::int64);
+  const char* expected[] = {"0", "1.5", "1", "007", "2.50", "0.1", "-5", "-0", "12345678901234567", "-12", " 3", "1e+20"};
+  for (size_t row = 0; row < formatted.rows(); row++) {
+    for (size_t column = 0; column < 3; column++) {
+      ASSERT_EQ(formatted.str(row, column), expected[row * 3 + column]);
+      ASSERT_EQ(formatted.get(row, column), expected[row * 3 + column]);
+    }
+  }
+  ASSERT_EQ(formatted.native(1, 0), true);
+  ASSERT_EQ(formatted.get<int>(1, 0), 7);
+  ASSERT_EQ(formatted.get<double>(1, 1), 2.5);
+  ASSERT_EQ(formatted.get<double>(3, 1), 3.0);
+  ASSERT_EQ(formatted.native(3, 2), false);  // not an integer
+  ASSERT_EQ(formatted.get<double>(3, 2), 1e20);
+  ASSERT_EQ(sampled.get(3, 4), "late");
+  ASSERT_EQ(sampled.get(0, 4), "");
+  return 0;
+}
+
+int test_dictionary_columnar() {
+  std::string csv = "id,status,note\n";
+  const char* statuses[] = {"ok", "failed", "", "pending"};
+  for (size_t row = 0; row < 100; row++) {
+    csv += std::to_string(row) + "," + statuses[row % 4] + ",\"note, " + std::to_string(row) + "\"\n";
+  }
+  std::istringstream text_in(csv);
+  std::istringstream in(csv);
+  pH::csv::mapped text(text_in);
+  pH::csv::mapped_typed_columnar data(in, 8, 4);
+  ASSERT_EQ(data.type("id"), pH::csv::column_type::int64);
+  ASSERT_EQ(data.type("status"), pH::csv::column_type::dictionary);
+  ASSERT_EQ(data.type("note"), pH::csv::column_type::string);
+  ASSERT_EQ(data.dictionary("status").size(), 4);
+  for (size_t row = 0; row < text.rows(); row++) {
+    ASSERT_EQ(data.get(row, "status"), text.at(row, "status"));
+    ASSERT_EQ(data.str(row, "status"), text.at(row, "status"));
+    ASSERT_EQ(data.native(row, data.headerIndex("status")), false);
+    ASSERT_EQ(data.dictionary("status")[data.codes("status")[row]], text.at(row, "status"));
+  }
+
+  std::vector<size_t> failed = data.findRows("status", "failed");
+  ASSERT_EQ(failed.size(), 25);
+  for (size_t row : failed) {
+    ASSERT_EQ(text.at(row, "status"), "failed");
+  }
+  ASSERT_EQ(data.findRows("status", "unknown").size(), 0);
+  ASSERT_EQ(data.code("status", "unknown"), data.dictionary("status").size());
+  std::vector<std::vector<size_t>> groups = data.groupRows("status");
+  ASSERT_EQ(groups.size(), 4);
+  ASSERT_EQ(groups[data.code("status", "")].size(), 25);
+  ASSERT_EQ(groups[data.code("status", "pending")][1], 7);
+
+  // Values that appear after the sample are added to the dictionary
+  std::istringstream late_in("a\nb\na\nc\n");
+  pH::csv::typed_columnar late(late_in, 2, 2);
+  ASSERT_EQ(late.type(0), pH::csv::column_type::dictionary);
+  ASSERT_EQ(late.dictionary(0).size(), 3);
+  ASSERT_EQ(late.get(3, 0), "c");
+
+  // Columns with more distinct values than dictionary_size stay strings
+  std::istringstream plain_in("a\nb\nc\n");
+  ASSERT_EQ(pH::csv::typed_columnar(plain_in, 3, 2).type(0), pH::csv::column_type::string);
+
+  // Without values in the sample, or with the default dictionary_size, columns are not dictionary encoded
+  std::istringstream unsampled_in("id,name\n1,a\n2,b\n3,a\n");
+  pH::csv::mapped_typed_columnar unsampled(unsampled_in, 0);
+  ASSERT_EQ(unsampled.type("id"), pH::csv::column_type::string);
+  ASSERT_EQ(unsampled.type("name"), pH::csv::column_type::string);
+  ASSERT_EQ(unsampled.get(2, "name"), "a");
+  std::istringstream unsampled_dictionary_in("id,name\n1,a\n2,b\n");
+  ASSERT_EQ(pH::csv::mapped_typed_columnar(unsampled_dictionary_in, 0, 4).type("name"), pH::csv::column_type::string);
+  std::istringstream header_only_in("id,name\n");
+  pH::csv::mapped_typed_columnar header_only(header_only_in);
+  ASSERT_EQ(header_only.rows(), 0);
+  ASSERT_EQ(header_only.type("id"), pH::csv::column_type::string);
+  ASSERT_EQ(header_only.type("name"), pH::csv::column_type::string);
+  std::istringstream short_in("a,b\nc\nd\n");
+  pH::csv::typed_columnar short_rows(short_in, 1, 4);
+  ASSERT_EQ(short_rows.type(0), pH::csv::column_type::dictionary);
+  ASSERT_EQ(short_rows.type(1), pH::csv::column_type::dictionary);
+  std::istringstream missing_in("x,y\na\nb,c\n");
+  pH::csv::mapped_typed_columnar missing(missing_in, 1, 4);
+  ASSERT_EQ(missing.type("x"), pH::csv::column_type::dictionary);
+  ASSERT_EQ(missing.type("y"), pH::csv::column_type::string);
+  ASSERT_EQ(missing.get(1, "y"), "c");
+  return 0;
+}
+
+int test_arena() {
+  for (const std::string& csv : parserTestCases()) {
+    std::istringstream flat_in(csv);
+    std::istringstream arena_in(csv);
+    pH::csv::flat data(flat_in);
+    pH::csv::arena_flat arena_data(arena_in);
+    ASSERT_EQ(arena_data.rows(), data.rows());
+    ASSERT_EQ(arena_data.columns(), data.columns());
+    for (size_t row = 0; row < data.rows(); row++) {
+      ASSERT_EQ(arena_data.columns(row), data.columns(row));
+      for (size_t column = 0; column < data.columns(row); column++) {
+        ASSERT_EQ(arena_data.get(row, column), data.at(row, column));
+      }
+    }
+    std::ostringstream flat_out;
+    std::ostringstream arena_out;
+    data.write(flat_out);
+    arena_data.write(arena_out);
+    ASSERT_EQ(arena_out.str(), flat_out.str());
+  }
+
+  pH::csv::mapped text(TESTDATA_DIR "/wiki_extended.csv");
+  pH::csv::arena_mapped data(TESTDATA_DIR "/wiki_extended.csv");
+  ASSERT_EQ(data.header() == text.header(), true);
+  ASSERT_EQ(data.get<int>(0, "Year"), 1997);
+  ASSERT_EQ(data.get<double>(1, "Price"), 4900.0);
+  ASSERT_EQ(data.get(3, "Description"), text.at(3, "Description"));
+
+  // Modified fields grow on the heap, the rest of the table is unchanged
+  const std::string long_value(100, 'x');
+  data.at(0, "Model") = long_value.c_str();
+  data.at(0, "Model") += long_value.c_str();
+  data.at(1, "Make").clear();
+  data.emplaceRow();
+  data.at(4, "Year") = "2024";
+  data.emplaceColumn("Color");
+  data.at(2, "Color").assign(long_value.data(), long_value.size());
+  ASSERT_EQ(data.get(0, "Model"), long_value + long_value);
+  ASSERT_EQ(data.get(1, "Make"), "");
+  ASSERT_EQ(data.get<int>(4, "Year"), 2024);
+  ASSERT_EQ(data.get(2, "Color"), long_value);
+  ASSERT_EQ(data.get(2, "Model"), text.at(2, "Model"));
+
+  // Copies don't use the arena, so they can outlive the table
+  pH::csv::arena_mapped::field_type field;
+  pH::csv::arena_mapped copy(std::vector<std::string>{"a"});
+  {
+    pH::csv::arena_mapped original(TESTDATA_DIR "/wiki_extended.csv");
+    field = original.at(3, "Description");
+    copy = original;
+  }
+  ASSERT_EQ(std::string(field.data(), field.size()), text.at(3, "Description"));
+  ASSERT_EQ(copy.get(2, "Model"), text.at(2, "Model"));
+  copy.resizeColumns(2);
+  ASSERT_EQ(copy.columns(), 2);
+  return 0;
+}
+
+int test_projection() {
+  pH::csv::mapped full(TESTDATA_DIR "/wiki_extended.csv");
+  pH::csv::mapped data(TESTDATA_DIR "/wiki_extended.csv", {"Price", "Model"});
+  ASSERT_EQ(data.columns(), 2);
+  ASSERT_EQ(data.rows(), full.rows());
+  for (size_t row = 0; row < data.rows(); row++) {
+    ASSERT_EQ(data.at(row, 0), full.at(row, "Price"));
+    ASSERT_EQ(data.at(row, "Model"), full.at(row, "Model"));
+  }
+
+  pH::csv::flat flat_full(TESTDATA_DIR "/wiki_extended_no_header.csv");
+  pH::csv::flat flat_data(TESTDATA_DIR "/wiki_extended_no_header.csv", {2, 0, 10});
+  ASSERT_EQ(flat_data.rows(), flat_full.rows());
+  for (size_t row = 0; row < flat_data.rows(); row++) {
+    ASSERT_EQ(flat_data.at(row, 0), flat_full.at(row, 2));
+    ASSERT_EQ(flat_data.at(row, 1), flat_full.at(row, 0));
+    ASSERT_EQ(flat_data.at(row, 2), "");
+  }
+
+  size_t row = 0;
+  std::vector<std::string> columns = {"Year"};
+  pH::csv::streamRows(TESTDATA_DIR "/wiki_extended.csv", columns, [&row, &full] (const pH::csv::mapped_row& projected) {
+    if (projected.size() != 1 || projected.at("Year") != full.at(row++, "Year")) {
+      throw std::runtime_error("Projected row does not match");
+    }
+    try {
+      projected.at("Make");
+      throw std::logic_error("Column outside of projection was accessible");
+    } catch (const std::runtime_error&) {}
+  });
+  ASSERT_EQ(row, full.rows());
+
+  try {
+    pH::csv::mapped missing(TESTDATA_DIR "/wiki_extended.csv", {"Color"});
+    return 1;
+  } catch (const std::runtime_error&) {}
+  return 0;
+}
+
+int test_filter() {
+  using pH::csv::equals;
+  pH::csv::mapped full(TESTDATA_DIR "/wiki_extended.csv");
+  auto expectRows = [&full] (const pH::csv::filter& rows, const std::vector<size_t>& expected) {
+    pH::csv::mapped data(TESTDATA_DIR "/wiki_extended.csv", rows);
+    std::vector<std::vector<std::string>> streamed;
+    pH::csv::streamRows(TESTDATA_DIR "/wiki_extended.csv", rows, [&streamed] (const pH::csv::mapped_row& row) {
+      streamed.emplace_back();
+      for (size_t i = 0; i < row.size(); i++) {
+        streamed.back().push_back(row.at(i));
+      }
+    });
+    if (data.rows() != expected.size() || streamed.size() != expected.size() || data.columns() != full.columns()) {
+      return 1;
+    }
+    for (size_t i = 0; i < expected.size(); i++) {
+      for (size_t column = 0; column < full.columns(); column++) {
+        if (data.at(i, column) != full.at(expected[i], column) || streamed[i][column] != full.at(expected[i], column)) {
+          return 1;
+        }
+      }
+    }
+    return 0;
+  };
+  ASSERT_EQ(expectRows(equals("Make", "Chevy"), {1, 2}), 0);
+  ASSERT_EQ(expectRows(pH::csv::startsWith("Model", "Venture \"Extended Edition,"), {2}), 0);
+  ASSERT_EQ(expectRows(pH::csv::lessThan("Price", 4900.0), {0, 3}), 0);
+  ASSERT_EQ(expectRows(pH::csv::greaterThan("Price", 4900.0), {2}), 0);
+  ASSERT_EQ(expectRows({pH::csv::between(4, 4799.0, 4900.0), equals(0, "1999")}, {1}), 0);
+  ASSERT_EQ(expectRows(pH::csv::lessThan("Make", 1.0), {}), 0);  // not numeric
+  ASSERT_EQ(expectRows(equals("Extras", ""), {3}), 0);  // missing field
+  ASSERT_EQ(expectRows(pH::csv::lessThan("Extras", 1.0), {}), 0);
+  ASSERT_EQ(expectRows(pH::csv::startsWith("Extras", "a"), {}), 0);
+
+  // Filter on columns outside the projection
+  pH::csv::mapped data(TESTDATA_DIR "/wiki_extended.csv", {"Model"}, equals("Year", "1999"));
+  ASSERT_EQ(data.rows(), 2);
+  ASSERT_EQ(data.columns(), 1);
+  ASSERT_EQ(data.at(0, "Model"), full.at(1, "Model"));
+
+  size_t rows = 0;
+  pH::csv::streamRows(TESTDATA_DIR "/wiki_extended_no_header.csv", equals(1, "Jeep"), [&rows] (const std::vector<std::string>& row) {
+    rows += row.at(2) == "Grand Cherokee";
+  });
+  ASSERT_EQ(rows, 1);
+  return 0;
+}
+
+int test_column_handle() {
+  pH::csv::mapped data(TESTDATA_DIR "/wiki_extended.csv");
+  pH::csv::column_handle price = data.column("Price");
+  ASSERT_EQ(static_cast<bool>(price), true);
+  ASSERT_EQ(static_cast<bool>(pH::csv::column_handle()), false);
+  ASSERT_EQ(price.index(), 4);
+  ASSERT_EQ(data.at(3, price), "4799.00");
+  ASSERT_EQ(data.get<double>(1, price), 4900.0);
+  ASSERT_EQ(data.get<double>(3, data.column("Extras"), -1.0), -1.0);
+  data.at(0, price) = "2999.00";
+  ASSERT_EQ(data.get<double>(0, "Price"), 2999.0);
+
+  // Index follows changes to the header
+  data.emplaceColumn("Color");
+  ASSERT_EQ(data.headerIndex("Color"), 6);
+  data.resizeColumns(2);
+  try {
+    data.column("Price");
+    return 1;
+  } catch (const std::runtime_error&) {}
+
+  // First of duplicate columns is used
+  std::istringstream duplicates("a,b,a\n1,2,3");
+  ASSERT_EQ(pH::csv::mapped(duplicates).get<int>(0, "a"), 1);
+
+  pH::csv::column_handle model;
+  std::vector<std::string> models;
+  pH::csv::streamRows(TESTDATA_DIR "/wiki_extended.csv", [&model, &models] (const pH::csv::mapped_row& row) {
+    if (!model) {
+      model = row.column("Model");
+    }
+    if (row.at(model) != row.at("Model")) {
+      throw std::runtime_error("Column handle does not match name");
+    }
+    models.push_back(row.get(model));
+  });
+  ASSERT_EQ(models.size(), 4);
+  ASSERT_EQ(models[3], "Grand Cherokee");
+  return 0;
+}
+
+int test_lazy() {
+  for (const std::string& csv : parserTestCases()) {
+    std::istringstream flat_in(csv);
+    std::istringstream lazy_in(csv);
+    pH::csv::flat data(flat_in);
+    pH::csv::flat_lazy lazy_data(lazy_in);
+    ASSERT_EQ(lazy_data.rows(), data.rows());
+    ASSERT_EQ(lazy_data.columns(), data.columns());
+    for (size_t row = 0; row < data.rows(); row++) {
+      ASSERT_EQ(lazy_data.columns(row), data.columns(row));
+      for (size_t column = 0; column < data.columns(row); column++) {
+        ASSERT_EQ(lazy_data.at(row, column), data.at(row, column));
+      }
+    }
+  }
+
+  pH::csv::mapped data(TESTDATA_DIR "/wiki_extended.csv");
+  pH::csv::mapped_lazy lazy_data(TESTDATA_DIR "/wiki_extended.csv");
+  ASSERT_EQ(lazy_data.rows(), data.rows());
+  ASSERT_EQ(lazy_data.columns(), data.columns());
+  ASSERT_EQ(lazy_data.at(3, "Extras"), "");
+  ASSERT_EQ(lazy_data.get<double>(1, "Price"), 4900.0);
+  // Decoded once, then cached
+  ASSERT_EQ(lazy_data.at(2, "Model"), data.at(2, "Model"));
+  ASSERT_EQ(lazy_data.at(2, "Model").data() == lazy_data.at(2, 2).data(), true);
+
+  size_t row = 0;
+  pH::csv::streamRows(TESTDATA_DIR "/wiki_extended.csv", [&row, &data, &lazy_data] (const pH::csv::mapped_lazy_row& lazy_row) {
+    if (lazy_row.size() != data.columns()) {
+      throw std::runtime_error("Lazy row has wrong size");
+    }
+    for (size_t column = 0; column < lazy_row.size(); column++) {
+      if (lazy_row.at(column) != data.at(row, column) || lazy_row.at(lazy_data.header().at(column)) != data.at(row, column)) {
+        throw std::runtime_error("Lazy row does not match");
+      }
+    }
+    row++;
+  });
+  ASSERT_EQ(row, data.rows());
+  return 0;
+}
+
+int test_batches() {
+  pH::csv::mapped data(TESTDATA_DIR "/wiki_extended.csv");
+  for (size_t batch_size : {1, 3, 4, 100}) {
+    size_t row = 0;
+    const std::vector<std::string>* first_row = nullptr;
+    pH::csv::streamBatches(TESTDATA_DIR "/wiki_extended.csv", batch_size, [&] (const pH::csv::mapped_row_batch& batch) {
+      if (batch.size() > batch_size || (first_row != nullptr && first_row != &batch.at(0))) {
+        throw std::runtime_error("Batch storage is not reused");
+      }
+      first_row = &batch.at(0);
+      for (size_t i = 0; i < batch.size(); i++, row++) {
+        for (size_t column = 0; column < data.columns(); column++) {
+          if (batch.at(i, column) != data.at(row, column)) {
+            throw std::runtime_error("Batch does not match");
+          }
+        }
+        if (batch.get<double>(i, "Price") != data.get<double>(row, "Price")) {
+          throw std::runtime_error("Batch does not match");
+        }
+      }
+    });
+    ASSERT_EQ(row, data.rows());
+  }
+
+  pH::csv::flat flat_data(TESTDATA_DIR "/wiki_extended_no_header.csv");
+  std::vector<std::vector<std::string>> rows;
+  pH::csv::streamBatches(TESTDATA_DIR "/wiki_extended_no_header.csv", 2, [&rows] (const pH::csv::row_batch& batch) {
+    rows.insert(rows.end(), batch.begin(), batch.end());
+  });
+  ASSERT_EQ(rows.size(), flat_data.rows());
+  for (size_t row = 0; row < rows.size(); row++) {
+    ASSERT_EQ(rows[row].size(), flat_data.columns(row));
+    ASSERT_EQ(rows[row].at(2), flat_data.at(row, 2));
+  }
+  return 0;
+}
+
+std::string referenceWrite(const std::vector<std::vector<std::string>>& rows) {
+  std::ostringstream out;
+  std::ostreambuf_iterator<char> it(out);
+  for (size_t i = 0; i < rows.size(); i++) {
+    pH::csv::detail::writeCsvRow(it, rows[i]);
+    if (i != rows.size() - 1) {
+      it = '\n';
+    }
+  }
+  return out.str();
+}
+
+int test_writer() {
+  // Separators and quotes at every position of fields up to 40 bytes, around the block sizes
+  std::vector<std::vector<std::string>> rows;
+  for (size_t size = 0; size < 40; size++) {
+    for (size_t position = 0; position < size; position++) {
+      for (char special : {',', '"', '\n'}) {
+        std::string field(size, 'x');
+        field[position] = special;
+        rows.push_back({field, std::string(size, 'y'), ""});
+      }
+    }
+  }
+  rows.push_back({});
+  rows.push_back({"\"\"", "a\"b\"c", ",,"});
+
+  std::ostringstream out;
+  {
+    pH::csv::writer csv(out, 64);
+    for (const auto& row : rows) {
+      csv.writeRow(row);
+    }
+    ASSERT_EQ(csv.rows(), rows.size());
+  }
+  ASSERT_EQ(out.str(), referenceWrite(rows));
+
+  std::ostringstream view_out;
+  pH::csv::writer view_csv(view_out);
+  view_csv.writeRow(std::vector<pH::csv::view>{"a,b", "c"});
+  view_csv.writeRow({"d", "e\"f"});
+  view_csv.flush();
+  ASSERT_EQ(view_out.str(), "\"a,b\",c\nd,\"e\"\"f\"");
+
+  // Header without rows ends with a newline
+  std::ostringstream header_out;
+  pH::csv::mapped(std::vector<std::string>{"a", "b"}).write(header_out);
+  ASSERT_EQ(header_out.str(), "a,b\n");
+  return 0;
+}
+
+int test_typed_writer() {
+  std::ostringstream out;
+  {
+    pH::csv::writer csv(out);
+    csv.writeValues(std::string("id"), "name", "value", "flag");
+    csv.writeValues(-42, "a,b", 0.1, true);
+    csv.writeValues(std::numeric_limits<int64_t>::min(), pH::csv::view("say \"hi\""), 1e20, false);
+    csv.writeValues(std::numeric_limits<uint64_t>::max(), ',', -0.0, 'x');
+    csv.writeField(1.5f).writeField(1e-5).writeField(100.0).writeField(123456.789);
+    csv.endRow();
+    csv.endRow();
+    csv.writeValues(std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity(), std::nan(""), 5e-324);
+    ASSERT_EQ(csv.rows(), 7);
+  }
+  ASSERT_EQ(out.str(),
+            "id,name,value,flag\n"
+            "-42,\"a,b\",0.1,true\n"
+            "-9223372036854775808,\"say \"\"hi\"\"\",1e+20,false\n"
+            "18446744073709551615,\",\",-0,x\n"
+            "1.5,1e-05,100,123456.789\n"
+            "\n"
+            "inf,-inf,nan,5e-324");
+
+  // Doubles and floats are written with the fewest digits that read back to the same value
+  std::vector<double> doubles = {1.0 / 3, 2.0 / 3, 1e300, 1.7976931348623157e308, 2.2250738585072014e-308, 123456789012345680.0, 0.3, 9007199254740993.0};
+  std::vector<float> floats = {1.0f / 3, 3.4028235e38f, 1e-45f, 0.1f, 16777217.0f};
+  uint64_t state = 12345;
+  for (int i = 0; i < 10000; i++) {
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    double value;
+    uint64_t bits = state;
+    std::memcpy(&value, &bits, sizeof(value));
+    if (std::isfinite(value)) {
+      doubles.push_back(value);
+    }
+    uint32_t float_bits = static_cast<uint32_t>(state >> 32);
+    float float_value;
+    std::memcpy(&float_value, &float_bits, sizeof(float_value));
+    if (std::isfinite(float_value)) {
+      floats.push_back(float_value);
+    }
+  }
+  std::ostringstream number_out;
+  {
+    pH::csv::writer csv(number_out);
+    for (double value : doubles) {
+      csv.writeValues(value);
+    }
+    for (float value : floats) {
+      csv.writeValues(value);
+    }
+  }
+  std::istringstream number_in(number_out.str());
+  pH::csv::flat numbers(number_in);
+  ASSERT_EQ(numbers.rows(), doubles.size() + floats.size());
+  for (size_t i = 0; i < doubles.size(); i++) {
+    ASSERT_EQ(numbers.get<double>(i, 0), doubles[i]);
+    ASSERT_EQ(numbers.at(i, 0).size() <= 24, true);
+  }
+  for (size_t i = 0; i < floats.size(); i++) {
+    ASSERT_EQ(numbers.get<float>(doubles.size() + i, 0), floats[i]);
+  }
+  ASSERT_EQ(numbers.at(0, 0), "0.3333333333333333");
+  ASSERT_EQ(numbers.at(6, 0), "0.3");
+  ASSERT_EQ(numbers.at(doubles.size() + 3, 0), "0.1");
+  return 0;
+}
+
+int test_row_index() {
+  for (const std::string& csv : parserTestCases()) {
+    auto expected = referenceRows(csv);
+    for (size_t stride : {1, 2, 3, 1024}) {
+      std::istringstream in(csv);
+      pH::csv::row_index index(in, stride);
+      ASSERT_EQ(index.rows(), expected.size());
+      ASSERT_EQ(index.size(), csv.size());
+
+      // Saved and loaded indexes are the same
+      std::stringstream saved;
+      index.write(saved);
+      pH::csv::row_index loaded;
+      loaded.read(saved);
+      ASSERT_EQ(loaded.rows(), index.rows());
+
+      for (size_t first = 0; first <= expected.size(); first++) {
+        for (size_t count : {0, 1, 2, 1000}) {
+          std::vector<std::vector<std::string>> rows;
+          in.clear();
+          pH::csv::streamRows(in, loaded, first, count, [&rows] (const std::vector<std::string>& row) {
+            rows.push_back(row);
+          });
+          auto begin = expected.begin() + first;
+          auto end = begin + std::min(count, expected.size() - first);
+          if (rows != std::vector<std::vector<std::string>>(begin, end)) {
+            printf("Indexed rows %zu to %zu with stride %zu differ:\n%s\n", first, first + count, stride, csv.c_str());
+            return 1;
+          }
+        }
+      }
+    }
+  }
+
+  // Files with header
+  pH::csv::mapped data(TESTDATA_DIR "/wiki_extended.csv");
+  pH::csv::row_index index(TESTDATA_DIR "/wiki_extended.csv", 2);
+  ASSERT_EQ(index.rows(), data.rows() + 1);
+  size_t row = 2;
+  pH::csv::streamRows(TESTDATA_DIR "/wiki_extended.csv", index, 2, 10, [&data, &row] (const pH::csv::mapped_row& mapped_row) {
+    if (mapped_row.at("Model") != data.at(row, "Model") || mapped_row.size() != data.columns()) {
+      throw std::runtime_error("Indexed row does not match mapped");
+    }
+    row++;
+  });
+  ASSERT_EQ(row, data.rows());
+
+  // Indexes of other inputs are rejected
+  std::istringstream changed("a,b\nc,d");
+  bool thrown = false;
+  try {
+    pH::csv::streamRows(changed, index, 0, 1, [] (const std::vector<std::string>&) {});
+  } catch (const std::runtime_error&) {
+    thrown = true;
+  }
+  ASSERT_EQ(thrown, true);
+  return 0;
+}
+
+int test_scan_shape() {
+  for (const std::string& csv : parserTestCases()) {
+    auto expected = referenceRows(csv);
+    std::istringstream in(csv);
+    pH::csv::shape shape = pH::csv::scanShape(in);
+    ASSERT_EQ(shape.rows, expected.size());
+    ASSERT_EQ(shape.size, csv.size());
+    size_t ragged = 0;
+    for (const auto& row : expected) {
+      ASSERT_EQ(shape.min_columns <= row.size() && row.size() <= shape.max_columns, true);
+      ASSERT_EQ(shape.row_counts.at(row.size()) > 0, true);
+      ragged += row.size() != expected.front().size() ? 1 : 0;
+    }
+    ASSERT_EQ(shape.ragged_rows, ragged);
+  }
+
+  std::istringstream ragged("a,b\n1\n2,3\n4,5,6\n");
+  pH::csv::shape shape = pH::csv::scanShape(ragged, 1);
+  ASSERT_EQ(shape.rows, 4);
+  ASSERT_EQ(shape.min_columns, 1);
+  ASSERT_EQ(shape.max_columns, 3);
+  ASSERT_EQ(shape.row_counts[2], 2);
+  ASSERT_EQ(shape.ragged_rows, 2);
+  ASSERT_EQ(shape.ragged_offsets.size(), 1);
+  ASSERT_EQ(shape.ragged_offsets[0], 4);
+  ASSERT_EQ(shape.malformed_rows, 0);
+
+  // Quotes in unquoted fields, unpaired quotes and unterminated quotes
+  for (const char* csv : {"a,b\n1,x\"y\n", "a,b\n1,\"x\"y\n", "a,b\n1,\"x"}) {
+    std::istringstream in(csv);
+    shape = pH::csv::scanShape(in);
+    ASSERT_EQ(shape.malformed_rows, 1);
+    ASSERT_EQ(shape.malformed_offsets.at(0), 4);
+  }
+  std::istringstream valid("a,\"b\"\"\"\n\"1\n2\",\"\"");
+  ASSERT_EQ(pH::csv::scanShape(valid).malformed_rows, 0);
+
+  shape = pH::csv::scanShape(TESTDATA_DIR "/wiki_extended.csv");
+  pH::csv::mapped data(TESTDATA_DIR "/wiki_extended.csv");
+  ASSERT_EQ(shape.rows, data.rows() + 1);
+  return 0;
+}
+
+std::string replaceAll(std::string str, const std::string& from, const std::string& to) {
+  for (size_t pos = str.find(from); pos != std::string::npos; pos = str.find(from, pos + to.size())) {
+    str.replace(pos, from.size(), to);
+  }
+  return str;
+}
+
+int test_follower() {
+  std::string csv = readFile(TESTDATA_DIR "/wiki_extended.csv").front();
+  std::istringstream reference_in(csv);
+  pH::csv::mapped reference(reference_in);
+  for (size_t chunk_size : {1, 7, 100}) {
+    std::remove(TMP_FILE.c_str());
+    pH::csv::follower follower(TMP_FILE);
+    std::vector<std::string> models;
+    auto parse_func = [&models] (const pH::csv::mapped_row& row) { models.push_back(row.at("Model")); };
+    ASSERT_EQ(follower.poll(parse_func), 0);
+    std::string saved;
+    for (size_t begin = 0; begin < csv.size(); begin += chunk_size) {
+      std::ofstream out(TMP_FILE, std::ios::out | std::ios::binary | std::ios::app);
+      out << csv.substr(begin, chunk_size);
+      out.close();
+      if (begin < csv.size() / 2) {
+        follower.poll(parse_func);
+        std::ostringstream position;
+        follower.write(position);
+        saved = position.str();
+      } else {
+        // Resumes from the saved position, like after a restart
+        pH::csv::follower resumed(TMP_FILE);
+        std::istringstream position(saved);
+        resumed.read(position);
+        resumed.poll(parse_func);
+        std::ostringstream new_position;
+        resumed.write(new_position);
+        saved = new_position.str();
+      }
+    }
+    ASSERT_EQ(models.size(), reference.rows());
+    for (size_t row = 0; row < reference.rows(); row++) {
+      ASSERT_EQ(models[row], reference.at(row, "Model"));
+    }
+  }
+
+  // The last row is only read once its newline is written
+  std::ofstream(TMP_FILE, std::ios::out | std::ios::binary) << "a,b\n1,\"2\n";
+  pH::csv::follower follower(TMP_FILE, false);
+  std::vector<std::vector<std::string>> rows;
+  auto parse_func = [&rows] (const std::vector<std::string>& row) { rows.push_back(row); };
+  ASSERT_EQ(follower.poll(parse_func), 1);
+  ASSERT_EQ(follower.offset(), 4);
+  std::ofstream(TMP_FILE, std::ios::out | std::ios::binary | std::ios::app) << "3\"";
+  ASSERT_EQ(follower.poll(parse_func), 0);
+  std::ofstream(TMP_FILE, std::ios::out | std::ios::binary | std::ios::app) << "\n";
+  ASSERT_EQ(follower.poll(parse_func), 1);
+  ASSERT_EQ(rows.back()[1], "2\n3");
+  ASSERT_EQ(follower.rows(), 2);
+
+  std::ofstream(TMP_FILE, std::ios::out | std::ios::binary) << "a\n";
+  bool threw = false;
+  try {
+    follower.poll(parse_func);
+  } catch (const std::runtime_error&) {
+    threw = true;
+  }
+  ASSERT_EQ(threw, true);
+  std::remove(TMP_FILE.c_str());
+  return 0;
+}
+
+int test_push_parser() {
+  for (const std::string& csv : parserTestCases()) {
+    auto expected = referenceRows(csv);
+    for (size_t chunk_size : {1, 2, 3, 7, 64, 1 << 16}) {
+      std::vector<std::vector<std::string>> rows;
+      pH::csv::push_parser parser([&rows] (const std::vector<pH::csv::view>& row) {
+        rows.emplace_back();
+        for (const auto& field : row) {
+          rows.back().push_back(field.str());
+        }
+      });
+      for (size_t begin = 0; begin < csv.size(); begin += chunk_size) {
+        // Copies each chunk to check that no views into earlier buffers are kept
+        std::string chunk = csv.substr(begin, chunk_size);
+        parser.feed(chunk.data(), chunk.size());
+      }
+      parser.finish();
+      if (rows != expected) {
+        printf("Push parser output differs from readCsvRow for chunk size %zu:\n%s\n", chunk_size, csv.c_str());
+        return 1;
+      }
+      ASSERT_EQ(parser.rows(), expected.size());
+    }
+  }
+
+  // Fields of rows within one buffer point into it
+  std::string buffer = "a,\"b,c\"\n\"d\"\"\",e\nf";
+  std::vector<const char*> fields;
+  pH::csv::push_parser parser([&fields] (const std::vector<pH::csv::view>& row) {
+    for (const auto& field : row) {
+      fields.push_back(field.data());
+    }
+  });
+  parser.feed(buffer);
+  ASSERT_EQ(fields.size(), 4);
+  ASSERT_EQ(fields[0] == buffer.data(), true);
+  ASSERT_EQ(fields[1] == buffer.data() + 3, true);
+  ASSERT_EQ(fields[3] == buffer.data() + 14, true);
+  parser.finish();
+  ASSERT_EQ(fields.size(), 5);
+  ASSERT_EQ(parser.rows(), 3);
+
+  // A quoted field with many lines, fed one line at a time, is scanned once
+  std::vector<std::string> texts;
+  pH::csv::push_parser text_parser([&texts] (const std::vector<pH::csv::view>& row) {
+    texts.push_back(row.at(1).str());
+  });
+  std::string text;
+  text_parser.feed("1,\"");
+  for (size_t line = 0; line < 20000; line++) {
+    std::string chunk = "line \"\"" + std::to_string(line) + "\"\",\n";
+    text_parser.feed(chunk);
+    text += "line \"" + std::to_string(line) + "\",\n";
+  }
+  text_parser.feed("\",x\n2,y\n");
+  ASSERT_EQ(texts.size(), 2);
+  ASSERT_EQ(texts[0] == text, true);
+  ASSERT_EQ(texts[1], "y");
+
+  // Quotes before the '\r' of a "\r\n" line ending close a field split across buffers
+  std::vector<std::vector<std::string>> crlf_rows;
+  pH::csv::basic_push_parser<pH::csv::crlf_csv_dialect> crlf_parser([&crlf_rows] (const std::vector<pH::csv::view>& row) {
+    crlf_rows.emplace_back();
+    for (const auto& field : row) {
+      crlf_rows.back().push_back(field.str());
+    }
+  });
+  for (const char* chunk : {"a,\"b\r\n", "c\"", "\"\"", "\r", "\n\"d\"\r,e\"\r\n", "f\r\n"}) {
+    crlf_parser.feed(chunk, std::strlen(chunk));
+  }
+  ASSERT_EQ(crlf_rows.size(), 3);
+  ASSERT_EQ(crlf_rows[0] == std::vector<std::string>({"a", "b\r\nc\""}), true);
+  ASSERT_EQ(crlf_rows[1] == std::vector<std::string>({"d\"\r,e"}), true);
+  ASSERT_EQ(crlf_rows[2] == std::vector<std::string>({"f"}), true);
+  return 0;
+}
+
+int test_row_range() {
+  for (const std::string& csv : parserTestCases()) {
+    std::istringstream in(csv);
+    std::vector<std::vector<std::string>> rows;
+    for (const auto& row : pH::csv::row_range(in, 7)) {
+      rows.push_back(row);
+    }
+    ASSERT_EQ(rows == referenceRows(csv), true);
+  }
+
+  pH::csv::mapped data(TESTDATA_DIR "/wiki_extended.csv");
+  pH::csv::mapped_row_range cars(TESTDATA_DIR "/wiki_extended.csv");
+  ASSERT_EQ(cars.header() == data.header(), true);
+  size_t row = 0;
+  for (const pH::csv::mapped_row& car : cars) {
+    ASSERT_EQ(car.at("Model"), data.at(row, "Model"));
+    ASSERT_EQ(car.get<int>("Year"), data.get<int>(row, "Year"));
+    row++;
+  }
+  ASSERT_EQ(row, data.rows());
+  ASSERT_EQ(cars.begin() == cars.end(), true);
+
+  // Stops reading when the loop stops
+  std::string csv = "id,value\n";
+  for (size_t i = 0; i < 100000; i++) {
+    csv += std::to_string(i) + ",x\n";
+  }
+  std::istringstream in(csv);
+  pH::csv::mapped_row_range range(in, 1 << 12);
+  auto found = std::find_if(range.begin(), range.end(), [] (const pH::csv::mapped_row& r) { return r.at("id") == "100"; });
+  ASSERT_EQ(found->get<int>("id"), 100);
+  ASSERT_EQ(in.tellg() <= 2 * (1 << 12), true);
+  ++found;
+  ASSERT_EQ(found->at(0), "101");
+
+  // Ranges can be moved while they are iterated
+  std::istringstream flat_in("a\nb\nc\n");
+  pH::csv::row_range letters(flat_in);
+  auto it = letters.begin();
+  ASSERT_EQ(it->at(0), "a");
+  pH::csv::row_range moved(std::move(letters));
+  ASSERT_EQ((*moved.begin())[0], "a");
+  ++it;
+  ASSERT_EQ(it->at(0), "b");
+
+  // Postfix increment returns the row before the increment
+  std::istringstream postfix_in("a\nb\nc\n");
+  pH::csv::row_range postfix(postfix_in);
+  auto letter = postfix.begin();
+  ASSERT_EQ((*letter++)[0], "a");
+  auto previous = letter++;
+  ASSERT_EQ(previous->at(0), "b");
+  ASSERT_EQ(letter->at(0), "c");
+  letter++;
+  ASSERT_EQ(letter == postfix.end(), true);
+
+  std::istringstream mapped_in("id,value\n1,x\n2,y\n");
+  pH::csv::mapped_row_range mapped_rows(mapped_in);
+  auto mapped_it = mapped_rows.begin();
+  auto first = mapped_it++;
+  ASSERT_EQ(first->at("value"), "x");
+  ASSERT_EQ((*mapped_it++).get<int>("id"), 2);
+  ASSERT_EQ(first->get<int>("id"), 1);
+  ASSERT_EQ(mapped_it == mapped_rows.end(), true);
+  return 0;
+}
+
+int test_dialects() {
+  using pH::csv::detail::simd;
+  for (simd level : {simd::none, simd::sse2, simd::avx2}) {
+    if (!pH::csv::detail::useSimd(level)) {
+      continue;
+    }
+    for (const std::string& csv : parserTestCases()) {
+      // Swapping separators and quotes in the input swaps them in the fields
+      std::string pipes = csv;
+      for (char& c : pipes) {
+        c = c == ',' ? '|' : c == '|' ? ',' : c == '"' ? '\'' : c == '\'' ? '"' : c;
+      }
+      auto expected = referenceRows(csv);
+      std::vector<std::vector<std::string>> rows;
+      std::istringstream pipes_in(pipes);
+      pH::csv::streamRows(pipes_in, pH::csv::dialect<'|', '\''>(), [&rows] (const std::vector<std::string>& row) {
+        std::vector<std::string> swapped = row;
+        for (std::string& field : swapped) {
+          for (char& c : field) {
+            c = c == ',' ? '|' : c == '|' ? ',' : c == '"' ? '\'' : c == '\'' ? '"' : c;
+          }
+        }
+        rows.push_back(swapped);
+      });
+      if (rows != expected) {
+        printf("Pipe dialect output differs for simd level %d:\n%s\n", static_cast<int>(level), csv.c_str());
+        return 1;
+      }
+
+      // "\r\n" line endings read like "\n", except inside quoted fields
+      std::istringstream crlf_in(replaceAll(csv, "\n", "\r\n"));
+      pH::csv::flat crlf_data(crlf_in, pH::csv::crlf_csv_dialect());
+      ASSERT_EQ(crlf_data.rows(), expected.size());
+      for (size_t row = 0; row < expected.size(); row++) {
+        ASSERT_EQ(crlf_data.columns(row), expected[row].size());
+        for (size_t column = 0; column < expected[row].size(); column++) {
+          ASSERT_EQ(crlf_data.at(row, column), replaceAll(expected[row][column], "\n", "\r\n"));
+        }
+      }
+    }
+  }
+  pH::csv::detail::useSimd(simd::avx2) || pH::csv::detail::useSimd(simd::sse2);
+
+  // TSV round trip, tabs and quotes in fields are quoted
+  pH::csv::mapped data(TESTDATA_DIR "/wiki_extended.csv");
+  data.at(0, "Make") = "Fo\trd";
+  data.at(3, "Description") = "MUST SELL! air, moon roof, loaded";  // line breaks are not quoted, like in writeCsvRow
+  std::ostringstream tsv_out;
+  data.write(tsv_out, pH::csv::tsv_dialect());
+  ASSERT_EQ(tsv_out.str().substr(0, tsv_out.str().find('\n')), "Year\tMake\tModel\tDescription\tPrice\tExtras");
+  std::istringstream tsv_in(tsv_out.str());
+  ASSERT_EQ(pH::csv::mapped(tsv_in, pH::csv::tsv_dialect()) == data, true);
+
+  // CRLF writer
+  std::ostringstream crlf_out;
+  {
+    pH::csv::basic_writer<pH::csv::crlf_csv_dialect> csv(crlf_out);
+    csv.writeRow({"a", "b,c"});
+    csv.writeValues(1, "\"x\"");
+  }
+  ASSERT_EQ(crlf_out.str(), "a,\"b,c\"\r\n1,\"\"\"x\"\"\"");
+  std::istringstream crlf_in(crlf_out.str());
+  size_t rows = 0;
+  pH::csv::streamRows(crlf_in, pH::csv::crlf_csv_dialect(), [&rows] (const pH::csv::mapped_row& row) {
+    if (row.at("a") != "1" || row.at("b,c") != "\"x\"") {
+      throw std::runtime_error("Unexpected CRLF row");
+    }
+    rows++;
+  });
+  ASSERT_EQ(rows, 1);
+  return 0;
+}
+
 int main() {
-  return test_mapped_wiki() + test_flat_wiki() + test_streaming() + test_create_csv();
+  return test_mapped_wiki() + test_flat_wiki() + test_streaming() + test_schema() + test_conversion() + test_create_csv() + test_tokenizer() + test_columnar() + test_typed_columnar() + test_dictionary_columnar() + test_arena() + test_projection() + test_filter() + test_column_handle() + test_lazy() + test_batches() + test_writer() + test_typed_writer() + test_row_index() + test_scan_shape() + test_follower() + test_push_parser() + test_row_range() + test_dialects();
 }
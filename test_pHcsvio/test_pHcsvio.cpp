@@ -0,0 +1,267 @@
+#include "pHcsvio.h"
+
+#include <sstream>
+
+template<typename T>
+inline std::string toString(const T& val) {
+  return std::to_string(val);
+}
+
+template<>
+inline std::string toString(const std::string& val) {
+  return val;
+}
+
+template<>
+inline std::string toString(const pH::csv::view& val) {
+  return val.str();
+}
+
+#define ASSERT_EQ(expr, expected) if ((expr) != (expected)) { printf("Assert failed at line %d:\n  %s != %s\n", __LINE__, toString(expr).c_str(), #expected); return 1; }
+
+const std::vector<std::string> EDGE_CASES = {
+  "",
+  "a,b,\n",
+  "a,b,",
+  "\n\n",
+  "\"a\"\"\",\"\"\"\",\"\n\"",
+  "a\"\"b,\"x\"y,z\"\n\"unterminated\"\"",
+  "1,\"2,3\"\"\",4\r\n5,6"
+};
+
+int compareFlat(const pH::csv::flat_view& view_data, const pH::csv::flat& data) {
+  ASSERT_EQ(view_data.rows(), data.rows());
+  ASSERT_EQ(view_data.columns(), data.columns());
+  for (size_t row = 0; row < data.rows(); row++) {
+    ASSERT_EQ(view_data.columns(row), data.columns(row));
+    for (size_t column = 0; column < data.columns(row); column++) {
+      ASSERT_EQ(view_data.at(row, column), data.at(row, column));
+    }
+  }
+  return 0;
+}
+
+int compareFlat(const pH::csv::flat_snapshot& snapshot, const pH::csv::flat& data) {
+  ASSERT_EQ(snapshot.rows(), data.rows());
+  ASSERT_EQ(snapshot.columns(), data.columns());
+  for (size_t row = 0; row < data.rows(); row++) {
+    ASSERT_EQ(snapshot.columns(row), data.columns(row));
+    for (size_t column = 0; column < data.columns(row); column++) {
+      ASSERT_EQ(snapshot.at(row, column), data.at(row, column));
+    }
+  }
+  return 0;
+}
+
+int test_flat_view() {
+  for (const char* file : {"/wiki.csv", "/wiki_extended.csv", "/wiki_extended_no_header.csv"}) {
+    std::string filename = std::string(TESTDATA_DIR) + file;
+    if (compareFlat(pH::csv::flat_view(filename), pH::csv::flat(filename)) != 0) {
+      printf("flat_view does not match flat for %s\n", file);
+      return 1;
+    }
+  }
+  for (const std::string& csv : EDGE_CASES) {
+    std::istringstream in(csv);
+    if (compareFlat(pH::csv::flat_view(csv.data(), csv.size()), pH::csv::flat(in)) != 0) {
+      printf("flat_view does not match flat for %s\n", csv.c_str());
+      return 1;
+    }
+  }
+
+  pH::csv::flat_view data(TESTDATA_DIR "/wiki_extended_no_header.csv");
+  ASSERT_EQ(data.at(0, 5), "steering \"wheel\"");
+  ASSERT_EQ(data.at(0, 1), "Ford");
+  ASSERT_EQ(data.get<int>(0, 0), 1997);
+  ASSERT_EQ(data.get<double>(1, 4), 4900.0);
+  return 0;
+}
+
+int test_mapped_view() {
+  for (const char* file : {"/wiki.csv", "/wiki_extended.csv"}) {
+    std::string filename = std::string(TESTDATA_DIR) + file;
+    pH::csv::mapped_view view_data(filename);
+    pH::csv::mapped data(filename);
+    ASSERT_EQ(view_data.columns(), data.columns());
+    for (size_t column = 0; column < data.columns(); column++) {
+      ASSERT_EQ(data.headerIndex(view_data.header().at(column)), column);
+    }
+    if (compareFlat(view_data, data) != 0) {
+      printf("mapped_view does not match mapped for %s\n", file);
+      return 1;
+    }
+  }
+
+  pH::csv::mapped_view data(TESTDATA_DIR "/wiki_extended.csv");
+  ASSERT_EQ(data.rows(), 4);
+  ASSERT_EQ(data.columns(), 6);
+  ASSERT_EQ(data.at(0, "Extras"), "steering \"wheel\"");
+  ASSERT_EQ(data.at(2, "Model"), "Venture \"Extended Edition, Very Large\"");
+  ASSERT_EQ(data.at(3, "Description"), "MUST SELL!\nair, moon \"\"roof\"\", loaded");
+  ASSERT_EQ(data.at(3, "Extras"), "");
+  ASSERT_EQ(data.get<size_t>(3, "Year"), 1996);
+  ASSERT_EQ(data.get<float>(3, "Price"), 4799.0f);
+  return 0;
+}
+
+int test_streaming_view() {
+  pH::csv::mapped data(TESTDATA_DIR "/wiki_extended.csv");
+  size_t row = 0;
+  pH::csv::streamRows(TESTDATA_DIR "/wiki_extended.csv", [&data, &row] (const pH::csv::mapped_view_row& view_row) {
+    for (size_t column = 0; column < data.columns(); column++) {
+      if (view_row.at(column) != data.at(row, column)) {
+        throw std::runtime_error("Streamed view does not match mapped");
+      }
+    }
+    if (view_row.at("Model") != data.at(row, "Model")) {
+      throw std::runtime_error("Streamed view does not match mapped");
+    }
+    row++;
+  });
+  ASSERT_EQ(row, data.rows());
+
+  pH::csv::flat flat_data(TESTDATA_DIR "/wiki_extended_no_header.csv");
+  row = 0;
+  pH::csv::streamRows(TESTDATA_DIR "/wiki_extended_no_header.csv", [&flat_data, &row] (const std::vector<pH::csv::view>& view_row) {
+    if (view_row.size() != flat_data.columns(row)) {
+      throw std::runtime_error("Streamed view does not match flat");
+    }
+    for (size_t column = 0; column < view_row.size(); column++) {
+      if (view_row.at(column) != flat_data.at(row, column)) {
+        throw std::runtime_error("Streamed view does not match flat");
+      }
+    }
+    row++;
+  });
+  ASSERT_EQ(row, flat_data.rows());
+  return 0;
+}
+
+int test_fd_istream() {
+  // Pipe
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  std::ifstream file(TESTDATA_DIR "/wiki_extended.csv", std::ios::in | std::ios::binary);
+  std::string csv((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  ASSERT_EQ(write(fds[1], csv.data(), csv.size()), static_cast<ssize_t>(csv.size()));
+  close(fds[1]);
+  pH::csv::fd_istream pipe_in(fds[0]);
+  pH::csv::mapped piped_data(pipe_in);
+  close(fds[0]);
+  if (piped_data != pH::csv::mapped(TESTDATA_DIR "/wiki_extended.csv")) {
+    printf("Data read from pipe does not match file\n");
+    return 1;
+  }
+
+  // File descriptor, through both std::istream interfaces
+  int fd = open(TESTDATA_DIR "/wiki_extended_no_header.csv", O_RDONLY);
+  pH::csv::fd_istream in(fd);
+  std::string first_line;
+  std::getline(in, first_line);
+  ASSERT_EQ(first_line, "1997,Ford,E350,\"ac, abs, moon\",3000.00,steering \"\"wheel\"\"");
+  size_t rows = 0;
+  pH::csv::streamRows(in, [&rows] (const std::vector<std::string>& row) {
+    if (rows == 0 && row.at(1) != "Chevy") {
+      throw std::runtime_error("Unexpected row read from file descriptor");
+    }
+    rows++;
+  });
+  close(fd);
+  ASSERT_EQ(rows, 3);
+  return 0;
+}
+
+void writeFile(const std::string& filename, const std::string& contents) {
+  std::ofstream out(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+  out << contents;
+}
+
+int test_snapshot() {
+  const std::string source = "snapshot_test.csv";
+  for (const std::string& csv : EDGE_CASES) {
+    writeFile(source, csv);
+    pH::csv::flat data(source);
+    pH::csv::writeSnapshot(data, source);
+    ASSERT_EQ(pH::csv::validSnapshot(source), true);
+    if (compareFlat(pH::csv::flat_snapshot(pH::csv::snapshotFilename(source)), data) != 0) {
+      printf("Snapshot does not match flat for \"%s\"\n", csv.c_str());
+      return 1;
+    }
+  }
+
+  std::ifstream file(TESTDATA_DIR "/wiki_extended.csv", std::ios::in | std::ios::binary);
+  std::string csv((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  writeFile(source, csv);
+  std::remove(pH::csv::snapshotFilename(source).c_str());
+  ASSERT_EQ(pH::csv::validSnapshot(source), false);
+  pH::csv::mapped data(source);
+  for (int load = 0; load < 2; load++) {
+    pH::csv::mapped_snapshot snapshot = pH::csv::readMappedCached(source);
+    ASSERT_EQ(pH::csv::validSnapshot(source), true);
+    ASSERT_EQ(snapshot.header() == data.header(), true);
+    ASSERT_EQ(snapshot.columns(), data.columns());
+    ASSERT_EQ(compareFlat(snapshot, data), 0);
+    ASSERT_EQ(snapshot.at(1, "Model"), data.at(1, "Model"));
+    ASSERT_EQ(snapshot.get<double>(2, snapshot.column("Price")), 5000.0);
+  }
+
+  // Stale snapshots are rewritten
+  writeFile(source, csv + "\n2000,Honda,Civic,,1000");
+  ASSERT_EQ(pH::csv::validSnapshot(source), false);
+  ASSERT_EQ(pH::csv::readMappedCached(source).rows(), pH::csv::mapped(source).rows());
+  ASSERT_EQ(pH::csv::readFlatCached(source, "snapshot_test.flat").rows(), pH::csv::flat(source).rows());
+  ASSERT_EQ(pH::csv::readFlatCached(source, "snapshot_test.flat").at(0, 0), "Year");
+
+  // Files that are not snapshots, or not of a mapped, are rejected
+  bool thrown = false;
+  try {
+    pH::csv::mapped_snapshot not_mapped("snapshot_test.flat");
+  } catch (const std::runtime_error&) {
+    thrown = true;
+  }
+  ASSERT_EQ(thrown, true);
+  thrown = false;
+  try {
+    pH::csv::flat_snapshot not_snapshot(source);
+  } catch (const std::runtime_error&) {
+    thrown = true;
+  }
+  ASSERT_EQ(thrown, true);
+
+  // Offsets out of order or out of bounds are rejected when they are read, opening only reads the header
+  writeFile(source, "a,b\nc,d\n");
+  pH::csv::writeSnapshot(pH::csv::flat(source), source);
+  const std::string snapshot = pH::csv::snapshotFilename(source);
+  const size_t row_offsets = sizeof(pH::csv::detail::snapshot_header);
+  const size_t field_offsets = row_offsets + 3 * sizeof(uint64_t);
+  for (size_t offset : {row_offsets, row_offsets + sizeof(uint64_t), field_offsets + sizeof(uint64_t), field_offsets + 3 * sizeof(uint64_t)}) {
+    pH::csv::writeSnapshot(pH::csv::flat(source), source);
+    ASSERT_EQ(pH::csv::flat_snapshot(snapshot).at(1, 1), "d");
+    std::fstream corrupt(snapshot, std::ios::in | std::ios::out | std::ios::binary);
+    uint64_t value = 1000;
+    corrupt.seekp(static_cast<std::streamoff>(offset));
+    corrupt.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    corrupt.close();
+    pH::csv::flat_snapshot corrupted(snapshot);
+    ASSERT_EQ(corrupted.rows(), 2);
+    thrown = false;
+    try {
+      for (size_t row = 0; row < corrupted.rows(); row++) {
+        for (size_t column = 0; column < corrupted.columns(row); column++) {
+          corrupted.at(row, column);
+        }
+      }
+    } catch (const std::runtime_error&) {
+      thrown = true;
+    }
+    ASSERT_EQ(thrown, true);
+  }
+  std::remove(source.c_str());
+  std::remove(pH::csv::snapshotFilename(source).c_str());
+  std::remove("snapshot_test.flat");
+  return 0;
+}
+
+int main() {
+  return test_flat_view() + test_mapped_view() + test_streaming_view() + test_fd_istream() + test_snapshot();
+}
@@ -1,9 +1,23 @@
 #include "pHcsvthread.h"
 
 #include <chrono>
+#include <cmath>
 #include <iostream>
+#include <map>
 #include <sstream>
 
+template<typename T>
+inline std::string toString(const T& val) {
+  return std::to_string(val);
+}
+
+template<>
+inline std::string toString(const std::string& val) {
+  return val;
+}
+
+#define ASSERT_EQ(expr, expected) if ((expr) != (expected)) { printf("Assert failed at line %d:\n  %s != %s\n", __LINE__, toString(expr).c_str(), #expected); return 1; }
+
 void logPerf(const std::string& label, std::chrono::time_point<std::chrono::high_resolution_clock> start) {
     std::cout << label << ": " << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() << " ms" << std::endl;
 }
@@ -161,9 +175,158 @@ SSO convertFromVec(const std::vector<std::string>& row) {
     return sso;
 }
 
+std::string written(const pH::csv::mapped& data, bool skip_header) {
+  std::ostringstream out;
+  data.write(out, skip_header);
+  return out.str();
+}
+
+int test_write_threaded() {
+  pH::csv::mapped data(TESTDATA_DIR "/wiki_extended.csv");
+  pH::csv::flat flat_data(TESTDATA_DIR "/wiki_extended_no_header.csv");
+  std::ostringstream flat_out;
+  flat_data.write(flat_out);
+  for (size_t num_threads : {1, 3}) {
+    // One job per row takes more than one round of jobs
+    for (size_t rows_per_job : {1, 2, 1000}) {
+      for (bool skip_header : {false, true}) {
+        std::ostringstream out;
+        pH::csv::detail::writeThreaded(out, data, skip_header ? nullptr : &data.header(), num_threads, rows_per_job);
+        ASSERT_EQ(out.str(), written(data, skip_header));
+      }
+      std::ostringstream out;
+      pH::csv::detail::writeThreaded(out, flat_data, nullptr, num_threads, rows_per_job);
+      ASSERT_EQ(out.str(), flat_out.str());
+    }
+  }
+  for (size_t num_threads : {0, 2}) {
+    std::ostringstream out;
+    pH::csv::writeThreaded(out, data, num_threads);
+    ASSERT_EQ(out.str(), written(data, false));
+    std::ostringstream skipped_out;
+    pH::csv::writeThreaded(skipped_out, data, num_threads, true);
+    ASSERT_EQ(skipped_out.str(), written(data, true));
+    std::ostringstream flat_threaded_out;
+    pH::csv::writeThreaded(flat_threaded_out, flat_data, num_threads);
+    ASSERT_EQ(flat_threaded_out.str(), flat_out.str());
+
+    // Empty tables, with and without header
+    std::istringstream header_only("Year,Make\n");
+    pH::csv::mapped empty(header_only);
+    ASSERT_EQ(empty.rows(), 0);
+    std::ostringstream empty_out;
+    pH::csv::writeThreaded(empty_out, empty, num_threads);
+    ASSERT_EQ(empty_out.str(), written(empty, false));
+    std::ostringstream empty_skipped_out;
+    pH::csv::writeThreaded(empty_skipped_out, empty, num_threads, true);
+    ASSERT_EQ(empty_skipped_out.str(), written(empty, true));
+    std::ostringstream empty_flat_out;
+    pH::csv::writeThreaded(empty_flat_out, pH::csv::flat(), num_threads);
+    ASSERT_EQ(empty_flat_out.str(), "");
+  }
+  return 0;
+}
+
+const std::string GROUP_CSV = "key,value,other\n"
+                              "a,1,x\n"
+                              "b,2.5,\n"
+                              "a,,3\n"
+                              "a,text,4\n"
+                              "b,-1,y\n"
+                              "c,abc,\n"
+                              "\"d,e\",7,\"8\"\n"
+                              "c,,z\n"
+                              "a,4,1e2\n";
+
+const std::vector<pH::csv::aggregate> GROUP_AGGREGATES = {
+  pH::csv::aggregate::sum("value"), pH::csv::aggregate::count(), pH::csv::aggregate::count("value"),
+  pH::csv::aggregate::min("value"), pH::csv::aggregate::max("value"), pH::csv::aggregate::max("other")};
+
+// Checks the groups of GROUP_CSV with GROUP_AGGREGATES
+int checkGroups(const pH::csv::grouped& groups) {
+  ASSERT_EQ(groups.size(), 4);
+  ASSERT_EQ(groups.keys() == std::vector<std::string>({"a", "b", "c", "d,e"}), true);
+  ASSERT_EQ(groups.rows("a"), 4);
+  ASSERT_EQ(groups.at("a", 0), 5.0);
+  ASSERT_EQ(groups.at("a", 1), 4.0);
+  ASSERT_EQ(groups.at("a", 2), 2.0);
+  ASSERT_EQ(groups.at("a", 3), 1.0);
+  ASSERT_EQ(groups.at("a", 4), 4.0);
+  ASSERT_EQ(groups.at("a", 5), 100.0);
+  ASSERT_EQ(groups.rows("b"), 2);
+  ASSERT_EQ(groups.at("b", 0), 1.5);
+  ASSERT_EQ(groups.at("b", 2), 2.0);
+  ASSERT_EQ(groups.at("b", 3), -1.0);
+  ASSERT_EQ(groups.at("b", 4), 2.5);
+  ASSERT_EQ(std::isnan(groups.at("b", 5)), true);  // empty and text fields only
+
+  // No numeric fields: sums and counts are 0, min and max are NaN
+  ASSERT_EQ(groups.at("c", 0), 0.0);
+  ASSERT_EQ(groups.at("c", 1), 2.0);
+  ASSERT_EQ(groups.at("c", 2), 0.0);
+  ASSERT_EQ(std::isnan(groups.at("c", 3)), true);
+  ASSERT_EQ(std::isnan(groups.at("c", 4)), true);
+  ASSERT_EQ(std::isnan(groups.at("c", 5)), true);
+  ASSERT_EQ(groups.at("d,e", 0), 7.0);
+  ASSERT_EQ(groups.at("d,e", 5), 8.0);
+
+  ASSERT_EQ(groups.contains("f"), false);
+  bool threw = false;
+  try {
+    groups.at("f", 0);
+  } catch (const std::out_of_range&) {
+    threw = true;
+  }
+  ASSERT_EQ(threw, true);
+  return 0;
+}
+
+int test_group_by() {
+  pH::csv::mapped cars(TESTDATA_DIR "/wiki.csv");
+  std::istringstream group_in(GROUP_CSV);
+  pH::csv::mapped group_data(group_in);
+  std::vector<pH::csv::aggregate> by_make_aggregates = {
+    pH::csv::aggregate::sum("Price"), pH::csv::aggregate::count(), pH::csv::aggregate::min("Year"),
+    pH::csv::aggregate::max("Year"), pH::csv::aggregate::count("Description"), pH::csv::aggregate::max("Description")};
+  for (size_t num_threads : {0, 3}) {
+    // One job per row, and one job for all rows
+    for (size_t rows_per_job : {1, 1000}) {
+      std::istringstream in(GROUP_CSV);
+      if (checkGroups(pH::csv::groupByThreaded(in, num_threads, "key", GROUP_AGGREGATES, rows_per_job)) != 0 ||
+          checkGroups(pH::csv::groupByThreaded(group_data, num_threads, "key", GROUP_AGGREGATES, rows_per_job)) != 0) {
+        return 1;
+      }
+
+      pH::csv::grouped from_file = pH::csv::groupByThreaded(TESTDATA_DIR "/wiki.csv", num_threads, "Make", by_make_aggregates, rows_per_job);
+      pH::csv::grouped from_mapped = pH::csv::groupByThreaded(cars, num_threads, "Make", by_make_aggregates, rows_per_job);
+      for (const pH::csv::grouped* by_make : {&from_file, &from_mapped}) {
+        ASSERT_EQ(by_make->keys() == std::vector<std::string>({"Chevy", "Ford", "Jeep"}), true);
+        ASSERT_EQ(by_make->at("Chevy", 0), 9900.0);
+        ASSERT_EQ(by_make->at("Chevy", 1), 2.0);
+        ASSERT_EQ(by_make->at("Chevy", 2), 1999.0);
+        ASSERT_EQ(by_make->at("Chevy", 3), 1999.0);
+        ASSERT_EQ(by_make->at("Ford", 0), 3000.0);
+        ASSERT_EQ(by_make->at("Ford", 2), 1997.0);
+        ASSERT_EQ(by_make->at("Jeep", 0), 4799.0);
+        ASSERT_EQ(by_make->rows("Jeep"), 1);
+        for (const std::string& make : by_make->keys()) {
+          ASSERT_EQ(by_make->at(make, 4), 0.0);
+          ASSERT_EQ(std::isnan(by_make->at(make, 5)), true);
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+// Without a mode, runs the tests. Modes run benchmarks on SsoObservation.csv, which must be
+// downloaded to test_data first.
 int main(int argc, char** argv) {
+    if (argc == 1) {
+        return test_write_threaded() + test_group_by();
+    }
     if (argc != 2) {
-        throw std::runtime_error("No mode specified");
+        throw std::runtime_error("Usage: test_pHcsvthread [mode]");
     }
     int mode = std::stoi(argv[1]);
     if (mode == 0 || mode == -1) {
@@ -219,4 +382,96 @@ int main(int argc, char** argv) {
       });
       logPerf("pH::csv::streamRowsThreaded (no_header)", start);
     }
+    if (mode == 6 || mode == -1) {
+      auto start = std::chrono::high_resolution_clock::now();
+      std::vector<SSO> ssos;
+      using pH::csv::column;
+      auto sso_schema = pH::csv::makeSchema(
+          column("solution_id", &SSO::solution_id),
+          column("source_id", &SSO::source_id),
+          column("observation_id", &SSO::observation_id),
+          column("number_mp", &SSO::number_mp),
+          column("epoch", &SSO::epoch),
+          column("epoch_err", &SSO::epoch_err),
+          column("epoch_utc", &SSO::epoch_utc),
+          column("ra", &SSO::ra),
+          column("dec", &SSO::dec),
+          column("ra_error_systematic", &SSO::ra_error_systematic),
+          column("dec_error_systematic", &SSO::dec_error_systematic),
+          column("ra_dec_correlation_systematic", &SSO::ra_dec_correlation_systematic),
+          column("ra_error_random", &SSO::ra_error_random),
+          column("dec_error_random", &SSO::dec_error_random),
+          column("ra_dec_correlation_random", &SSO::ra_dec_correlation_random),
+          column("g_mag", &SSO::g_mag, 0.0),
+          column("g_flux", &SSO::g_flux, 0.0),
+          column("g_flux_error", &SSO::g_flux_error, 0.0),
+          column("x_gaia", &SSO::x_gaia),
+          column("y_gaia", &SSO::y_gaia),
+          column("z_gaia", &SSO::z_gaia),
+          column("vx_gaia", &SSO::vx_gaia),
+          column("vy_gaia", &SSO::vy_gaia),
+          column("vz_gaia", &SSO::vz_gaia),
+          column("position_angle_scan", &SSO::position_angle_scan),
+          column("level_of_confidence", &SSO::level_of_confidence));
+      pH::csv::streamRows(TESTDATA_DIR "/SsoObservation.csv", sso_schema, [&ssos] (SSO&& sso) {
+          ssos.push_back(std::move(sso));
+      });
+      logPerf("pH::csv::streamRows (schema)", start);
+    }
+    if (mode == 7 || mode == -1) {
+      auto start = std::chrono::high_resolution_clock::now();
+      std::vector<std::pair<double, double>> positions;
+      std::mutex mut;
+      pH::csv::streamRowsThreaded(TESTDATA_DIR "/SsoObservation.csv", 3, {"ra", "dec"}, [&positions, &mut] (const pH::csv::mapped_row& row) {
+        std::pair<double, double> position(row.get<double>("ra"), row.get<double>("dec"));
+        std::lock_guard<std::mutex> lock(mut);
+        positions.push_back(position);
+      });
+      logPerf("pH::csv::streamRowsThreaded (projection)", start);
+    }
+    if (mode == 8 || mode == -1) {
+      pH::csv::mapped data(TESTDATA_DIR "/SsoObservation.csv");
+      auto start = std::chrono::high_resolution_clock::now();
+      std::ostringstream out;
+      data.write(out);
+      logPerf("pH::csv::mapped::write", start);
+      start = std::chrono::high_resolution_clock::now();
+      std::ostringstream threaded_out;
+      pH::csv::writeThreaded(threaded_out, data, 3);
+      logPerf("pH::csv::writeThreaded", start);
+      if (out.str() != threaded_out.str()) {
+        throw std::runtime_error("pH::csv::writeThreaded output differs from pH::csv::mapped::write");
+      }
+    }
+    if (mode == 9 || mode == -1) {
+      std::vector<pH::csv::aggregate> aggregates = {pH::csv::aggregate::sum("g_mag"), pH::csv::aggregate::min("ra"), pH::csv::aggregate::max("dec"), pH::csv::aggregate::count()};
+      auto start = std::chrono::high_resolution_clock::now();
+      std::map<std::string, double> g_mag;
+      std::map<std::string, size_t> rows;
+      std::mutex mut;
+      pH::csv::streamRowsThreaded(TESTDATA_DIR "/SsoObservation.csv", 3, [&g_mag, &rows, &mut] (const pH::csv::mapped_row& row) {
+        double value = row.at("g_mag").empty() ? 0.0 : row.get<double>("g_mag");
+        std::lock_guard<std::mutex> lock(mut);
+        g_mag[row.at("number_mp")] += value;
+        rows[row.at("number_mp")]++;
+      });
+      logPerf("pH::csv::streamRowsThreaded (group by)", start);
+      start = std::chrono::high_resolution_clock::now();
+      pH::csv::grouped streamed = pH::csv::groupByThreaded(TESTDATA_DIR "/SsoObservation.csv", 3, "number_mp", aggregates);
+      logPerf("pH::csv::groupByThreaded", start);
+      pH::csv::mapped data(TESTDATA_DIR "/SsoObservation.csv");
+      start = std::chrono::high_resolution_clock::now();
+      pH::csv::grouped loaded = pH::csv::groupByThreaded(data, 3, "number_mp", aggregates);
+      logPerf("pH::csv::groupByThreaded (mapped)", start);
+      if (streamed.keys().size() != rows.size() || loaded.keys() != streamed.keys()) {
+        throw std::runtime_error("pH::csv::groupByThreaded groups differ");
+      }
+      for (const auto& entry : rows) {
+        const std::string& key = entry.first;
+        if (streamed.rows(key) != entry.second || streamed.at(key, 3) != entry.second || std::abs(streamed.at(key, 0) - g_mag[key]) > 1e-6 * std::abs(g_mag[key]) ||
+            loaded.at(key, 1) != streamed.at(key, 1) || loaded.at(key, 2) != streamed.at(key, 2)) {
+          throw std::runtime_error("pH::csv::groupByThreaded differs from pH::csv::streamRowsThreaded for group " + key);
+        }
+      }
+    }
 }
@@ -0,0 +1,130 @@
+#include "pHcsvzip.h"
+
+#include <sstream>
+
+template<typename T>
+inline std::string toString(const T& val) {
+  return std::to_string(val);
+}
+
+template<>
+inline std::string toString(const std::string& val) {
+  return val;
+}
+
+#define ASSERT_EQ(expr, expected) if ((expr) != (expected)) { printf("Assert failed at line %d:\n  %s != %s\n", __LINE__, toString(expr).c_str(), #expected); return 1; }
+
+std::string readFile(const std::string& filename) {
+  std::ifstream in(filename, std::ios::in | std::ios::binary);
+  return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+std::string gzip(const std::string& data) {
+  z_stream stream;
+  std::memset(&stream, 0, sizeof(stream));
+  deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+  std::string result(deflateBound(&stream, data.size()), '\0');
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = static_cast<uInt>(data.size());
+  stream.next_out = reinterpret_cast<Bytef*>(&result[0]);
+  stream.avail_out = static_cast<uInt>(result.size());
+  deflate(&stream, Z_FINISH);
+  result.resize(stream.total_out);
+  deflateEnd(&stream);
+  return result;
+}
+
+std::string largeCsv() {
+  std::string csv = "id,name,value\n";
+  for (size_t i = 0; i < 100000; i++) {
+    csv += std::to_string(i) + ",\"name " + std::to_string(i % 97) + ", \"\"quoted\"\"\"," + std::to_string(i * 0.5) + "\n";
+  }
+  return csv;
+}
+
+int test_gzip() {
+  std::string csv = readFile(TESTDATA_DIR "/wiki_extended.csv");
+  pH::csv::mapped expected(TESTDATA_DIR "/wiki_extended.csv");
+
+  std::istringstream compressed(gzip(csv));
+  pH::csv::compressed_istream in(compressed);
+  if (pH::csv::mapped(in) != expected) {
+    printf("gzip input does not match\n");
+    return 1;
+  }
+
+  // Concatenated members, small chunks to exercise the queue
+  std::string rows = csv.substr(csv.find('\n') + 1);
+  std::istringstream concatenated(gzip(csv) + gzip(rows) + gzip(rows));
+  pH::csv::compressed_istream small_chunks(concatenated, 2, 7);
+  pH::csv::mapped data(small_chunks);
+  ASSERT_EQ(data.rows(), 3 * expected.rows());
+  ASSERT_EQ(data.at(11, "Description"), expected.at(3, "Description"));
+
+  std::string large = largeCsv();
+  std::istringstream large_compressed(gzip(large));
+  pH::csv::compressed_istream large_in(large_compressed);
+  std::istringstream large_plain(large);
+  size_t row = 0;
+  pH::csv::mapped large_expected(large_plain);
+  pH::csv::streamRows(large_in, [&row, &large_expected] (const pH::csv::mapped_row& data_row) {
+    if (data_row.at("name") != large_expected.at(row, "name") || data_row.at("value") != large_expected.at(row, "value")) {
+      throw std::runtime_error("Large gzip input does not match");
+    }
+    row++;
+  });
+  ASSERT_EQ(row, 100000);
+
+  // Errors on the decompression thread are thrown while reading
+  std::string truncated_data = gzip(csv);
+  std::istringstream truncated(truncated_data.substr(0, truncated_data.size() / 2));
+  pH::csv::compressed_istream truncated_in(truncated);
+  try {
+    pH::csv::mapped truncated_csv(truncated_in);
+    return 1;
+  } catch (const std::runtime_error&) {}
+
+  // Stops decompressing when destroyed before the end
+  std::istringstream unfinished(gzip(large));
+  pH::csv::compressed_istream unfinished_in(unfinished, 1, 16);
+  std::string line;
+  std::getline(unfinished_in, line);
+  ASSERT_EQ(line, "id,name,value");
+  return 0;
+}
+
+int test_uncompressed() {
+  pH::csv::compressed_istream in(TESTDATA_DIR "/wiki_extended_no_header.csv");
+  if (pH::csv::flat(in) != pH::csv::flat(TESTDATA_DIR "/wiki_extended_no_header.csv")) {
+    printf("Uncompressed input does not match\n");
+    return 1;
+  }
+  pH::csv::compressed_istream missing("missing.csv.gz");
+  ASSERT_EQ(missing.fail(), true);
+  std::istringstream empty("");
+  pH::csv::compressed_istream empty_in(empty);
+  ASSERT_EQ(pH::csv::flat(empty_in).rows(), 0);
+  return 0;
+}
+
+int test_zstd() {
+  // Frame of "a,b\n1,2\n"
+  const unsigned char frame[] = {0x28, 0xb5, 0x2f, 0xfd, 0x00, 0x58, 0x41, 0x00, 0x00, 0x61, 0x2c, 0x62, 0x0a, 0x31, 0x2c, 0x32, 0x0a};
+  std::istringstream compressed(std::string(reinterpret_cast<const char*>(frame), sizeof(frame)));
+  pH::csv::compressed_istream in(compressed);
+#ifdef PH_CSV_ZSTD
+  pH::csv::mapped data(in);
+  ASSERT_EQ(data.rows(), 1);
+  ASSERT_EQ(data.at(0, "b"), "2");
+#else
+  try {
+    pH::csv::mapped data(in);
+    return 1;
+  } catch (const std::runtime_error&) {}
+#endif
+  return 0;
+}
+
+int main() {
+  return test_gzip() + test_uncompressed() + test_zstd();
+}